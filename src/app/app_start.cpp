@@ -2,6 +2,12 @@
 #include "app_start.h"
 #include "src/types/MemoryManager.h"
 #include "scene.h"
+#include "scene_snapshot.h"
+#include "job_pool.h"
+#include "shadow_service.h"
+#include "tile_cache.h"
+#include "sprite_render.h"
+#include "resolution_control.h"
 #include "synth/map_synth.h"
 
 // Handy SDL docs: https://wiki.libsdl.org/
@@ -15,17 +21,15 @@ void HandleEvent(SDL_Event *event, volatile ApplicationGlobalState *state) {
         auto sym = event->key.keysym.sym;
         state->showColor = false;
         state->showHeight = false;
-        state->showShadow = false;
+        state->showLight = false;
         state->showDepth = false;
 
         if (sym == SDLK_q) {
             state->scene->shadowAngle += 1;
-            // update shadow with time. This should really be done on another thread, and rarely.
-            GenerateShadow(512, state->heightMap, state->shadowMap, state->scene->shadowAngle);
+            ShadowServiceRequest(state->scene->shadowAngle); // redrawn in the background, renderer picks it up when ready
         } else if (sym == SDLK_e){
             state->scene->shadowAngle -= 1;
-            // update shadow with time. This should really be done on another thread, and rarely.
-            GenerateShadow(512, state->heightMap, state->shadowMap, state->scene->shadowAngle);
+            ShadowServiceRequest(state->scene->shadowAngle); // redrawn in the background, renderer picks it up when ready
         }
 
         if (event->key.repeat > 0) return;
@@ -35,9 +39,21 @@ void HandleEvent(SDL_Event *event, volatile ApplicationGlobalState *state) {
         } else if (sym == SDLK_h) {
             state->showHeight = true;
         } else if (sym == SDLK_l) {
-            state->showShadow = true;
+            state->showLight = true;
         } else if (sym == SDLK_v) {
             state->showDepth = true;
+        } else if (sym == SDLK_f) {
+            state->scene->fixedPointMarch = !state->scene->fixedPointMarch;
+        } else if (sym == SDLK_m) {
+            state->scene->lodMarching = !state->scene->lodMarching;
+        } else if (sym == SDLK_g) {
+            state->scene->adaptiveResolution = !state->scene->adaptiveResolution;
+        } else if (sym == SDLK_k) {
+            state->scene->skipEmptySpace = !state->scene->skipEmptySpace;
+        } else if (sym == SDLK_t) {
+            state->scene->columnMajorTarget = !state->scene->columnMajorTarget;
+        } else if (sym == SDLK_p) {
+            state->scene->drawSprites = !state->scene->drawSprites;
         } else if (sym == SDLK_LEFT) {
             state->scene->moveTurnLeft = 1;
         } else if (sym == SDLK_RIGHT) {
@@ -93,7 +109,6 @@ void HandleEvent(SDL_Event *event, volatile ApplicationGlobalState *state) {
 }
 
 void UpdateModel(volatile ApplicationGlobalState *state, uint32_t frame, uint32_t frameTime) {
-    //MMPush(1 MEGABYTE); // prepare a per-frame bump allocator
     if (state == nullptr) return;
     if (frame < 0) return;
     if (frameTime < 0) return;
@@ -117,22 +132,23 @@ void UpdateModel(volatile ApplicationGlobalState *state, uint32_t frame, uint32_
     state->scene->camAngle += 0.03 * state->scene->moveTurnLeft;
 
 
-    //MMPop(); // wipe out anything we allocated in this frame.
+    // hand a copy to the renderer
+    SceneSnapshotPublish(state->sceneSnapshots, state->scene);
 }
 
-void showColorMap(volatile ApplicationGlobalState *state, SDL_Surface *screen) {
+// The map views show the tile under the camera
+void showColorMap(const MapTile *tile, SDL_Surface *screen) {
 
     auto base = (BYTE *) screen->pixels;
-    auto cmap = state->colorMap;
+    auto cmap = tile->color;
 
     int rowBytes = screen->pitch;
 
-    // for now, show the height map
-    for (int y = 0; y < 512; ++y) {
-        int mapY = y * 512 * 3;
+    for (int y = 0; y < TILE_SIZE; ++y) {
+        int mapY = y * TILE_SIZE * 3;
         int bmpY = y * rowBytes;
 
-        for (int x = 0; x < 512; ++x) {
+        for (int x = 0; x < TILE_SIZE; ++x) {
             int i = (x * 3) + mapY;
 
             BYTE r = cmap[i++];
@@ -147,18 +163,17 @@ void showColorMap(volatile ApplicationGlobalState *state, SDL_Surface *screen) {
     }
 }
 
-void showHeightMap(volatile ApplicationGlobalState *state, SDL_Surface *screen) {
+void showHeightMap(const MapTile *tile, SDL_Surface *screen) {
     auto base = (BYTE *) screen->pixels;
-    auto hmap = state->heightMap;
+    auto hmap = tile->height;
 
     int rowBytes = screen->pitch;
 
-    // for now, show the height map
-    for (int y = 0; y < 512; ++y) {
-        int mapY = y * 512;
+    for (int y = 0; y < TILE_SIZE; ++y) {
+        int mapY = y * TILE_SIZE;
         int bmpY = y * rowBytes;
 
-        for (int x = 0; x < 512; ++x) {
+        for (int x = 0; x < TILE_SIZE; ++x) {
             BYTE h = hmap[x + mapY];
 
             int j = (x * 4) + bmpY;
@@ -169,23 +184,23 @@ void showHeightMap(volatile ApplicationGlobalState *state, SDL_Surface *screen)
     }
 }
 
-void showShadowMap(volatile ApplicationGlobalState *state, SDL_Surface *screen) {
+void showLightMap(const MapTile *tile, SDL_Surface *screen) {
     auto base = (BYTE *) screen->pixels;
-    auto shadowMap = state->shadowMap;
+    auto lightMap = tile->light;
 
     int rowBytes = screen->pitch;
 
-    for (int y = 0; y < 512; ++y) {
-        int mapY = y * 512;
+    for (int y = 0; y < TILE_SIZE; ++y) {
+        int mapY = y * TILE_SIZE;
         int bmpY = y * rowBytes;
 
-        for (int x = 0; x < 512; ++x) {
-            BYTE h = shadowMap[x + mapY];
+        for (int x = 0; x < TILE_SIZE; ++x) {
+            BYTE h = lightMap[x + mapY];
 
             int j = (x * 4) + bmpY;
-            base[j++] = h * 0xFF; // B
-            base[j++] = h * 0xFF; // G
-            base[j++] = h * 0xFF; // R
+            base[j++] = h; // B
+            base[j++] = h; // G
+            base[j++] = h; // R
         }
     }
 }
@@ -217,19 +232,86 @@ void RenderFrame(volatile ApplicationGlobalState *state, SDL_Surface *screen) {
     if (state == nullptr) return;
     if (screen == nullptr) return;
 
-    if (state->showColor) {
-        showColorMap(state, screen);
-    } else if (state->showHeight) {
-        showHeightMap(state, screen);
-    } else if (state->showShadow) {
-        showShadowMap(state, screen);
+    // most recent scene from `UpdateModel`. We only read our own copy, so it can't change under us
+    auto scene = SceneSnapshotLatest(state->sceneSnapshots);
+    ShadowServiceAcquire(state); // newest complete lighting
+
+    auto tile = TileCacheFind(scene->camX, scene->camY);
+    if (state->showColor && tile != nullptr) {
+        showColorMap(tile, screen);
+    } else if (state->showHeight && tile != nullptr) {
+        showHeightMap(tile, screen);
+    } else if (state->showLight && tile != nullptr) {
+        showLightMap(tile, screen);
     } else if (state->showDepth) {
         showDepthMap(state, screen);
     } else {
-        // render the scene
-        RenderScene(state, screen);
+        // render the scene, and pick how many columns to draw next time from how long it took
+        uint64_t st = SDL_GetPerformanceCounter();
+        RenderScene(state, scene, screen);
+        double ms = (1000.0 * (double)(SDL_GetPerformanceCounter() - st)) / (double)SDL_GetPerformanceFrequency();
+
+        if (scene->adaptiveResolution) {
+            state->renderWidth = ResolutionNextWidth(ms, state->renderWidth, screen->w);
+        } else {
+            state->renderWidth = 0;
+            ResolutionReset();
+        }
     }
+}
 
+// Number of creatures scattered around the start point
+#define CREATURE_COUNT 4000
+// How far from the start point creatures are scattered, in map texels
+#define CREATURE_RANGE 700
+#define CREATURE_KINDS 3
+
+static uint32_t creaturePixels[CREATURE_KINDS][16 * 24];
+static SpriteImage creatureImages[CREATURE_KINDS];
+
+// A simple figure: a round head on a tapering body, with two dark eyes
+static void makeCreatureImage(SpriteImage* image, uint32_t* pixels, uint32_t body) {
+    image->width = 16;
+    image->height = 24;
+    image->pixels = pixels;
+    for (int y = 0; y < 24; y++) {
+        for (int x = 0; x < 16; x++) {
+            int dx = (2 * x) - 15;
+            bool head = y < 9 && ((dx * dx) + (((2 * y) - 8) * ((2 * y) - 8))) < 64;
+            bool torso = y >= 8 && abs(dx) < 14 - ((y - 8) / 3);
+            bool eye = y == 3 && (x == 5 || x == 10);
+            uint32_t c = 0; // clear
+            if (head || torso) c = 0xFF000000 | body;
+            if (eye) c = 0xFF101010;
+            pixels[(y * 16) + x] = c;
+        }
+    }
+}
+
+// Scatter creatures around a point. Same every run
+static void scatterCreatures(volatile ApplicationGlobalState *state, double x, double y) {
+    makeCreatureImage(&creatureImages[0], creaturePixels[0], 0xC03020);
+    makeCreatureImage(&creatureImages[1], creaturePixels[1], 0xD0C040);
+    makeCreatureImage(&creatureImages[2], creaturePixels[2], 0x6050C0);
+
+    auto sprites = (Sprite*) MMAllocate(CREATURE_COUNT * sizeof(Sprite));
+    uint32_t seed = 12345;
+    for (int i = 0; i < CREATURE_COUNT; i++) {
+        seed = (seed * 1103515245u) + 12345u;
+        double sx = (((seed >> 8) & 0xFFFF) / 65535.0) * 2.0 - 1.0;
+        seed = (seed * 1103515245u) + 12345u;
+        double sy = (((seed >> 8) & 0xFFFF) / 65535.0) * 2.0 - 1.0;
+
+        Sprite* sprite = &sprites[i];
+        sprite->x = x + (sx * CREATURE_RANGE);
+        sprite->y = y + (sy * CREATURE_RANGE);
+        sprite->lift = 0;
+        sprite->width = 3 + (float)(seed % 3);
+        sprite->height = sprite->width * 5.0f; // about 1.5 times taller than wide on screen
+        sprite->image = &creatureImages[i % CREATURE_KINDS];
+    }
+    state->sprites = sprites;
+    state->spriteCount = CREATURE_COUNT;
 }
 
 void StartUp(volatile ApplicationGlobalState *state) {
@@ -240,23 +322,33 @@ void StartUp(volatile ApplicationGlobalState *state) {
 
     MapSynthInit();
 
-    // synthesise maps. This should be dynamic based on wider area later
-    state->heightMap = (BYTE *) MMAllocate(512 * 512);
-    state->colorMap = (BYTE *) MMAllocate(512 * 512 * 3);
-    state->shadowMap = (BYTE *) MMAllocate(512 * 512);
-
     // screen-to-map lookups
     state->depthMap = (uint32_t*) MMAllocate(SCREEN_HEIGHT*SCREEN_WIDTH*4);
     state->coordMap = (uint32_t*) MMAllocate(SCREEN_HEIGHT*SCREEN_WIDTH*sizeof(uint32_t));
+    state->columnPixels = (uint32_t*) MMAllocate(SCREEN_HEIGHT*SCREEN_WIDTH*sizeof(uint32_t));
+    state->columnDepths = (uint32_t*) MMAllocate(SCREEN_HEIGHT*SCREEN_WIDTH*sizeof(uint32_t));
+    state->columnCoords = (uint32_t*) MMAllocate(SCREEN_HEIGHT*SCREEN_WIDTH*sizeof(uint32_t));
     InitScene(state);
+    state->sceneSnapshots = (SceneSnapshots*) MMAllocate(sizeof(SceneSnapshots));
+    SceneSnapshotInit(state->sceneSnapshots, state->scene);
+
+    // worker threads for the renderer
+    JobPoolStart(RENDER_THREADS);
+
+    // lighting is redrawn in the background from now on
+    ShadowServiceStart(state->scene->shadowAngle);
+
+    // map tiles are generated in the background as the camera moves. Wait for the first view to be ready
+    TileCacheStart(TILE_WORLD_SEED, state->scene->VIEW_DISTANCE); // sized for the view. Drawing is clamped to what it holds
+    TileCacheLoadArea(state->scene->camX, state->scene->camY, state->scene->VIEW_DISTANCE); // first view, across the job pool
 
-    state->mapSize = 512;
-    GenerateHeight(512, 5, state->heightMap);
-    GenerateColor(512, state->heightMap, state->colorMap);
-    GenerateShadow(512, state->heightMap, state->shadowMap, state->scene->shadowAngle);
+    scatterCreatures(state, state->scene->camX, state->scene->camY);
 }
 
 void Shutdown(volatile ApplicationGlobalState *state) {
+    ShadowServiceStop();
+    TileCacheStop();
+    JobPoolStop();
     state->scene = nullptr;
     MapSynthDispose();
 
@@ -21,6 +21,10 @@ const int SCREEN_HEIGHT = 600;//720;
 #define FRAME_LIMIT 1
 // If defined, renderer will run in a parallel thread. Otherwise, draw and render will run in sequence
 #define MULTI_THREAD 1
+// Number of threads used to draw the scene (including the render thread). 0 = one per CPU core.
+#define RENDER_THREADS 0
+// Scene columns are split into this many jobs per render thread. More jobs balance better, but cost more to hand out.
+#define RENDER_BANDS_PER_THREAD 4
 // If defined, the output screen will remain visible after the test run is complete
 //#define WAIT_AT_END 1
 
@@ -31,7 +35,7 @@ const int SCREEN_HEIGHT = 600;//720;
 
 // Called once at app start
 void StartUp(volatile ApplicationGlobalState *state);
-// Called for every frame. Update the scene ready for next render
+// Called for every frame. Update the scene ready for next render. Scratch memory from `MMFrameAllocate` lasts until the next call
 void UpdateModel(volatile ApplicationGlobalState *state, uint32_t frame, uint32_t frameTime);
 
 // Called for every frame. Draw scene to buffer
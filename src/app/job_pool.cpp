@@ -0,0 +1,115 @@
+#include "job_pool.h"
+
+#include <SDL.h>
+#include <SDL_mutex.h>
+#include <SDL_thread.h>
+#include <SDL_atomic.h>
+
+#define MAX_WORKERS 63
+
+static SDL_Thread* workers[MAX_WORKERS];
+static int workerCount = 0;
+
+static SDL_mutex* batchLock = nullptr; // one batch at a time
+static SDL_sem* startSignal = nullptr; // posted once per worker when a batch is ready
+static SDL_sem* doneSignal = nullptr; // posted once by each worker as it leaves a batch
+static volatile bool stopping = false;
+
+// current batch
+static JobFunc batchFunc = nullptr;
+static void* batchContext = nullptr;
+static int batchCount = 0;
+static SDL_atomic_t nextJob;
+
+// take jobs from the current batch until there are none left
+static void RunBatchJobs() {
+    while (true) {
+        int job = SDL_AtomicAdd(&nextJob, 1);
+        if (job >= batchCount) return;
+        batchFunc(batchContext, job);
+    }
+}
+
+static int JobWorker(void*) {
+    while (true) {
+        SDL_SemWait(startSignal);
+        if (stopping) break;
+
+        RunBatchJobs();
+        SDL_SemPost(doneSignal);
+    }
+    return 0;
+}
+
+void JobPoolStart(int threadCount) {
+    if (batchLock == nullptr) {
+        // Kept for the life of the program, so other threads can keep submitting batches while the pool is stopped and restarted
+        batchLock = SDL_CreateMutex();
+        startSignal = SDL_CreateSemaphore(0);
+        doneSignal = SDL_CreateSemaphore(0);
+    }
+
+    if (threadCount < 1) threadCount = SDL_GetCPUCount();
+    int wanted = threadCount - 1; // the calling thread does work too
+    if (wanted > MAX_WORKERS) wanted = MAX_WORKERS;
+
+    SDL_LockMutex(batchLock);
+    if (workerCount > 0) { // already running
+        SDL_UnlockMutex(batchLock);
+        return;
+    }
+
+    stopping = false;
+    SDL_AtomicSet(&nextJob, 0);
+
+    for (int i = 0; i < wanted; i++) {
+        workers[workerCount] = SDL_CreateThread(JobWorker, "JobWorker", nullptr);
+        if (workers[workerCount] == nullptr) break; // run with what we've got
+        workerCount++;
+    }
+    SDL_UnlockMutex(batchLock);
+}
+
+void JobPoolStop() {
+    if (batchLock == nullptr) return;
+
+    SDL_LockMutex(batchLock); // waits for any batch in progress
+    stopping = true;
+    for (int i = 0; i < workerCount; i++) SDL_SemPost(startSignal);
+    for (int i = 0; i < workerCount; i++) SDL_WaitThread(workers[i], nullptr);
+    workerCount = 0;
+    SDL_UnlockMutex(batchLock);
+}
+
+int JobPoolThreadCount() {
+    return workerCount + 1;
+}
+
+void JobPoolRun(JobFunc func, void* context, int jobCount) {
+    if (func == nullptr || jobCount < 1) return;
+
+    if (batchLock == nullptr || jobCount == 1) { // nothing to share with
+        for (int i = 0; i < jobCount; i++) func(context, i);
+        return;
+    }
+
+    SDL_LockMutex(batchLock);
+    if (workerCount < 1) { // pool is stopped, or there's only one core
+        SDL_UnlockMutex(batchLock);
+        for (int i = 0; i < jobCount; i++) func(context, i);
+        return;
+    }
+
+    batchFunc = func;
+    batchContext = context;
+    batchCount = jobCount;
+    SDL_AtomicSet(&nextJob, 0);
+
+    for (int i = 0; i < workerCount; i++) SDL_SemPost(startSignal); // wake the workers
+    RunBatchJobs();
+    for (int i = 0; i < workerCount; i++) SDL_SemWait(doneSignal); // barrier: everyone is out of the batch
+
+    batchFunc = nullptr;
+    batchContext = nullptr;
+    SDL_UnlockMutex(batchLock);
+}
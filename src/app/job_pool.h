@@ -0,0 +1,30 @@
+#ifndef SDLBASE_JOB_POOL_H
+#define SDLBASE_JOB_POOL_H
+
+/*
+    A small persistent worker pool for data-parallel jobs (render columns, map bands, etc).
+
+    Work is submitted as a batch of `jobCount` independent jobs, all using the same function and context.
+    The calling thread joins in on the batch, and `JobPoolRun` only returns once every job in the batch
+    has finished -- so it can be used as a per-frame barrier.
+
+    Any thread may submit a batch, but only one batch runs at a time. Jobs must not call `JobPoolRun` themselves.
+*/
+
+// Function run for each job in a batch. `context` is shared between all jobs in the batch
+typedef void (*JobFunc)(void* context, int jobIndex);
+
+// Start worker threads. `threadCount` is the total number of threads that work on a batch
+// (including the caller). If zero or less, one thread per CPU core is used.
+void JobPoolStart(int threadCount);
+
+// Stop and join all worker threads, after any batch in progress. Batches run after this will run on the calling thread.
+void JobPoolStop();
+
+// Total number of threads that take part in a batch (workers plus the calling thread)
+int JobPoolThreadCount();
+
+// Run a batch of jobs across the pool. Returns when all jobs have completed.
+void JobPoolRun(JobFunc func, void* context, int jobCount);
+
+#endif //SDLBASE_JOB_POOL_H
@@ -0,0 +1,102 @@
+#include "render_target.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TARGET_SSE2 1
+#endif
+
+// number of source columns read together. Their cache lines are re-used for each block of 4 rows
+#define TRANSPOSE_TILE 32
+
+RenderTarget SurfaceTarget(SDL_Surface* screen, uint32_t* depthMap, uint32_t* coordMap) {
+    RenderTarget t = {};
+    t.width = screen->w;
+    t.height = screen->h;
+    t.pixels = (uint32_t*)screen->pixels;
+    t.depths = depthMap;
+    t.coords = coordMap;
+    t.rowStep = screen->pitch / 4;
+    t.columnStep = 1;
+    t.depthRowStep = screen->w;
+    return t;
+}
+
+RenderTarget ColumnTarget(uint32_t* columnPixels, uint32_t* columnDepths, uint32_t* columnCoords, int width, int height) {
+    RenderTarget t = {};
+    t.width = width;
+    t.height = height;
+    t.pixels = columnPixels;
+    t.depths = columnDepths;
+    t.coords = columnCoords;
+    t.rowStep = 1;
+    t.columnStep = height;
+    t.depthRowStep = 1;
+    return t;
+}
+
+void TransposeToRows(const uint32_t* src, int width, int height, uint32_t* dst, int dstRowStep, int firstRow, int endRow) {
+    if (src == nullptr || dst == nullptr) return;
+    if (endRow > height) endRow = height;
+
+    for (int tx = 0; tx < width; tx += TRANSPOSE_TILE) {
+        int tileEnd = tx + TRANSPOSE_TILE;
+        if (tileEnd > width) tileEnd = width;
+
+        int y = firstRow;
+#ifdef TARGET_SSE2
+        int blockEnd = tx + ((tileEnd - tx) & ~3);
+        for (; y + 4 <= endRow; y += 4) {
+            int x = tx;
+            for (; x < blockEnd; x += 4) {
+                // four columns of four pixels...
+                __m128i c0 = _mm_loadu_si128((const __m128i*)(src + (x * height) + y));
+                __m128i c1 = _mm_loadu_si128((const __m128i*)(src + ((x + 1) * height) + y));
+                __m128i c2 = _mm_loadu_si128((const __m128i*)(src + ((x + 2) * height) + y));
+                __m128i c3 = _mm_loadu_si128((const __m128i*)(src + ((x + 3) * height) + y));
+
+                // ...become four rows of four pixels
+                __m128i t0 = _mm_unpacklo_epi32(c0, c1);
+                __m128i t1 = _mm_unpacklo_epi32(c2, c3);
+                __m128i t2 = _mm_unpackhi_epi32(c0, c1);
+                __m128i t3 = _mm_unpackhi_epi32(c2, c3);
+
+                uint32_t* out = dst + (y * dstRowStep) + x;
+                _mm_storeu_si128((__m128i*)out, _mm_unpacklo_epi64(t0, t1));
+                _mm_storeu_si128((__m128i*)(out + dstRowStep), _mm_unpackhi_epi64(t0, t1));
+                _mm_storeu_si128((__m128i*)(out + 2 * dstRowStep), _mm_unpacklo_epi64(t2, t3));
+                _mm_storeu_si128((__m128i*)(out + 3 * dstRowStep), _mm_unpackhi_epi64(t2, t3));
+            }
+            for (; x < tileEnd; x++) { // odd columns at the edge of the screen
+                for (int k = 0; k < 4; k++) dst[((y + k) * dstRowStep) + x] = src[(x * height) + y + k];
+            }
+        }
+#endif
+        for (; y < endRow; y++) { // scalar fallback, and any rows left over
+            uint32_t* out = dst + (y * dstRowStep);
+            for (int x = tx; x < tileEnd; x++) {
+                out[x] = src[(x * height) + y];
+            }
+        }
+    }
+}
+
+void StretchToRows(const uint32_t* src, int width, int height, uint32_t* dst, int dstWidth, int dstRowStep, int firstRow, int endRow) {
+    if (src == nullptr || dst == nullptr || width < 1) return;
+    if (endRow > height) endRow = height;
+
+    for (int tx = 0; tx < dstWidth; tx += TRANSPOSE_TILE) {
+        int tileEnd = tx + TRANSPOSE_TILE;
+        if (tileEnd > dstWidth) tileEnd = dstWidth;
+
+        const uint32_t* columns[TRANSPOSE_TILE]; // source column under each screen column in the tile
+        for (int x = tx; x < tileEnd; x++) {
+            columns[x - tx] = src + ((((int64_t)x * width) / dstWidth) * height);
+        }
+        for (int y = firstRow; y < endRow; y++) {
+            uint32_t* out = dst + (y * dstRowStep);
+            for (int x = tx; x < tileEnd; x++) {
+                out[x] = columns[x - tx][y];
+            }
+        }
+    }
+}
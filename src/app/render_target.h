@@ -0,0 +1,46 @@
+#ifndef SDLBASE_RENDER_TARGET_H
+#define SDLBASE_RENDER_TARGET_H
+
+#include <cstdint>
+#include <SDL.h>
+
+/*
+    Where ray-cast spans are written.
+
+    Pixel (x,y) is at `pixels[x * columnStep + y * rowStep]`, and the same for `depths` and `coords`.
+    A surface target has rowStep = pitch and columnStep = 1, so each vertical span lands a whole row apart.
+    A column target has rowStep = 1 and columnStep = height, so vertical spans are contiguous,
+    and is copied to the screen afterwards with `TransposeToRows`.
+*/
+typedef struct RenderTarget {
+    int width, height;
+
+    uint32_t* pixels; // packed 0x00RRGGBB
+    uint32_t* depths;
+    uint32_t* coords; // map texel under each pixel, see `PACK_MAP_COORD`
+    int rowStep; // distance between rows, in pixels
+    int columnStep; // distance between columns, in pixels
+
+    // depth and coordinate maps use their own row step when drawing straight to a surface (surface pitch may have padding)
+    int depthRowStep;
+} RenderTarget;
+
+// Target that draws straight onto a 32-bit surface, with depths and map coordinates in row-major maps `screen->w` wide.
+RenderTarget SurfaceTarget(SDL_Surface* screen, uint32_t* depthMap, uint32_t* coordMap);
+
+// Target that draws into column-major buffers of `width * height` pixels.
+RenderTarget ColumnTarget(uint32_t* columnPixels, uint32_t* columnDepths, uint32_t* columnCoords, int width, int height);
+
+// True if vertical spans are contiguous in memory
+inline bool IsColumnMajor(const RenderTarget* target) {
+    return target->rowStep == 1;
+}
+
+// Copy rows [firstRow, endRow) of a column-major buffer (`height` pixels per column)
+// into a row-major one with `dstRowStep` pixels per row. Works in 4x4 blocks, a few columns wide at a time.
+void TransposeToRows(const uint32_t* src, int width, int height, uint32_t* dst, int dstRowStep, int firstRow, int endRow);
+
+// The same, but stretched across `dstWidth` columns. Screen column x shows source column `x * width / dstWidth`
+void StretchToRows(const uint32_t* src, int width, int height, uint32_t* dst, int dstWidth, int dstRowStep, int firstRow, int endRow);
+
+#endif //SDLBASE_RENDER_TARGET_H
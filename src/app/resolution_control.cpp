@@ -0,0 +1,34 @@
+#include "resolution_control.h"
+#include "app_start.h"
+
+#define max(a,b) (((a) > (b)) ? (a) : (b))
+#define min(a,b) (((a) < (b)) ? (a) : (b))
+
+static double fullWidthCost[RESOLUTION_WINDOW]; // ms each recent frame would have taken at the whole screen width
+static int samples = 0; // how many of `fullWidthCost` are filled
+static int nextSample = 0; // ring position of the next one
+
+void ResolutionReset() {
+    samples = 0;
+    nextSample = 0;
+}
+
+int ResolutionNextWidth(double frameMs, int drawnWidth, int screenWidth) {
+    if (screenWidth < 1) return 0;
+    if (drawnWidth < 1 || drawnWidth > screenWidth) drawnWidth = screenWidth;
+
+    fullWidthCost[nextSample] = (frameMs * screenWidth) / drawnWidth;
+    nextSample = (nextSample + 1) % RESOLUTION_WINDOW;
+    samples = min(RESOLUTION_WINDOW, samples + 1);
+
+    double worst = 0;
+    for (int i = 0; i < samples; i++) worst = max(worst, fullWidthCost[i]);
+
+    double budget = FRAME_TIME_TARGET * RESOLUTION_BUDGET;
+    int width = (worst > budget) ? (int)((screenWidth * budget) / worst) : screenWidth;
+    width = min(width, drawnWidth + (int)(screenWidth * RESOLUTION_GROWTH)); // shrink at once, grow slowly
+
+    if (width >= screenWidth) return screenWidth;
+    width -= width % RESOLUTION_WIDTH_STEP;
+    return max((int)(screenWidth * RESOLUTION_MIN_SCALE), width);
+}
@@ -0,0 +1,37 @@
+#ifndef SDLBASE_RESOLUTION_CONTROL_H
+#define SDLBASE_RESOLUTION_CONTROL_H
+
+/*
+    Dynamic resolution: when frames take too long to draw, fewer columns are ray cast, and stretched across the screen.
+
+    Drawing time is close to proportional to the number of columns, so each frame time is scaled up to what the
+    whole screen width would have cost. The next width is what fits the budget at the worst of the last
+    `RESOLUTION_WINDOW` of those. A slow frame shrinks the width straight away; it only grows back a little each
+    frame, once the slow frames have left the window.
+
+    Only the render thread uses this.
+*/
+
+// Frame times remembered
+#define RESOLUTION_WINDOW 16
+
+// Part of `FRAME_TIME_TARGET` to fill with drawing. The rest is left for spikes the window hasn't seen yet
+#define RESOLUTION_BUDGET 0.8
+
+// Fewest columns drawn, as a fraction of the screen width
+#define RESOLUTION_MIN_SCALE 0.25
+
+// Widths are a multiple of this many columns
+#define RESOLUTION_WIDTH_STEP 8
+
+// Most the width can grow in one frame, as a fraction of the screen width
+#define RESOLUTION_GROWTH 0.03125
+
+// Forget the frame times, and go back to the whole screen width
+void ResolutionReset();
+
+// Record that the last frame took `frameMs` to draw with `drawnWidth` columns, and return how many columns to
+// draw next frame (at most `screenWidth`)
+int ResolutionNextWidth(double frameMs, int drawnWidth, int screenWidth);
+
+#endif //SDLBASE_RESOLUTION_CONTROL_H
@@ -3,40 +3,35 @@
 //
 #include "scene.h"
 #include "types/MemoryManager.h"
+#include "job_pool.h"
+#include "span_buffer.h"
+#include "tile_cache.h"
+#include "sprite_render.h"
+#include "synth/map_synth.h"
 
 #define max(a,b) (((a) > (b)) ? (a) : (b))
 #define min(a,b) (((a) < (b)) ? (a) : (b))
 
+// window = map tiles around the camera
 // line = vertical span index (x in render space)
 // x1,y1 = camera location (in map space)
 // x2,y2 = camera look
 // d = height of camera
 // xDir = camera direction
-void rayCast(volatile ApplicationGlobalState *state, NgScenePtr scene, SDL_Surface *screen, int shadowDarkness,
+// Visible texels are added to `spans` as fully shaded colors, ready to fill.
+void rayCast(volatile ApplicationGlobalState *state, const TileWindow *window, NgScenePtr scene, SpanBuffer *spans, int height,
              int line, double x1, double y1, double x2, double y2, double d /*,double xDir*/) { //xDir used for sky texture
 
-    if (state == nullptr || scene == nullptr) return;
-    int height = screen->h;
-
-    // Maps we read from:
-    BYTE* heights = state->heightMap; // todo: this should be in scene, not state
-    BYTE* colors = state->colorMap; // todo: this should be in scene, not state
-    BYTE* shadows = state->shadowMap;
-
-    // Maps we write to
-    uint32_t* depths = state->depthMap;
-    uint32_t* coords = state->coordMap;
-
-    // output pixel map
-    BYTE* base = (BYTE*)screen->pixels;
-    int xpos = line * 4; // pixel column
-    int rowBytes = screen->pitch;
-    int scrWidth = screen->w;
+    if (state == nullptr || window == nullptr || scene == nullptr) return;
 
     // x1, y1, x2, y2 are the start and end points on map for ray
     double dx = x2 - x1;
     double dy = y2 - y1;
 
+    // step in window space, where tile `window->tiles[0]` starts at 0,0
+    x1 -= window->originX * (double)TILE_SIZE;
+    y1 -= window->originY * (double)TILE_SIZE;
+
     double dp = fabs(d) / 100.0;
     double persp = 0;
 
@@ -50,9 +45,8 @@ void rayCast(volatile ApplicationGlobalState *state, NgScenePtr scene, SDL_Surfa
     double z3 = ymin+1;     // projected Z height of point under consideration
     double h=0;
     int hbound = height - 1;
-    int viewDistance = scene->VIEW_DISTANCE;
-    int yline = hbound * scrWidth;
-    int ypos = hbound * rowBytes; // y-offset in output pixel map. We tick this down, so have to be careful not to overdraw anywhere.
+    int viewDistance = min(TileCacheViewDistance(), scene->VIEW_DISTANCE); // no tiles are kept further out
+    int cursor = hbound; // next row to draw. We tick this up the screen, so have to be careful not to overdraw anywhere.
 
     // sky texture x coord
     //int sx = floor( (-xDir*(1 / 3.141592) + line) % skyWidth)*skyWidth;
@@ -65,14 +59,15 @@ void rayCast(volatile ApplicationGlobalState *state, NgScenePtr scene, SDL_Surfa
     double dfog = 1 / (viewDistance * 0.3);
     double fo=0,fs = 1;
 
-    int x,y,idx,cidx;
+    int x,y,idx;
 
     // local references
     double camHeight = scene->camHeight;
     double camV = scene->camPitch;
 
-    int mapWidth = state->mapSize;
-    int mapHeight = state->mapSize;
+    int windowTexels = TILE_WINDOW_SPAN * TILE_SIZE;
+    int litCopy = window->litCopy;
+    int originX = window->originX * TILE_SIZE, originY = window->originY * TILE_SIZE; // window space to map texels
 
     // MAIN LOOP
     // we draw from near to far
@@ -85,25 +80,22 @@ void rayCast(volatile ApplicationGlobalState *state, NgScenePtr scene, SDL_Surfa
         x1 = x1+dx;
         y1 = y1+dy;
 
-        // TODO: pick a map from a tileset based on global X,Y
-        //x = ((int)fabs(x1)) % mapWidth; // repeat, mirrored across 0
-        //y = ((int)fabs(y1)) % mapHeight;
         x = (int)x1;
         y = (int)y1;
-        if (x < 0 || x >= mapWidth) break; // show only one tile
-        if (y < 0 || y >= mapHeight) break;
-        idx = (y * mapWidth) + x;
-        cidx = idx * 3;
+        if (x < 0 || x >= windowTexels) break; // outside the window
+        if (y < 0 || y >= windowTexels) break;
+        const MapTile* tile = window->tiles[((y >> TILE_SHIFT) * TILE_WINDOW_SPAN) + (x >> TILE_SHIFT)];
+        if (tile == nullptr) break; // not loaded yet
+        idx = TileTexelIndex(x & TILE_MASK, y & TILE_MASK, 0);
+        uint32_t texel = tile->lit[litCopy][idx]; // lit color and height
 
         // get height
         double terrainHeight;
-        terrainHeight = heights[idx] * scene->heightScale;
+        terrainHeight = TEXEL_HEIGHT(texel) * scene->heightScale;
 
-        bool water = heights[idx] <= scene->waterLevel;
+        bool water = (int)TEXEL_HEIGHT(texel) <= scene->waterLevel;
         if (water) terrainHeight = scene->waterLevel;
 
-        int shadow = (int)shadows[idx]; // 1 if dark, 0 if bright. Used to bit shift
-
         if (scene->sharperPeaks) {
             terrainHeight *= terrainHeight / 127.0;
         }
@@ -122,15 +114,9 @@ void rayCast(volatile ApplicationGlobalState *state, NgScenePtr scene, SDL_Surfa
             int iz = (int)(min(hbound, ymin));
             //ypos = iz * rowBytes; // if this is needed, we're overdrawing somewhere?
 
-            // read color from image
-            int r = colors[cidx], g = colors[cidx+1], b =colors[cidx+2];
-
-            if (shadow){
-                // TODO: idea: have a dark & light floor texture, and blend between them.
-                r = max(0, r - shadowDarkness);
-                g = max(0, g - shadowDarkness);
-                b = max(0, b - shadowDarkness);
-            }
+            // read color from image. Light and shadow are already applied
+            uint32_t color = TEXEL_COLOR(texel);
+            int r = (int)((color >> 16) & 0xFF), g = (int)((color >> 8) & 0xFF), b = (int)(color & 0xFF);
 
             // fog effect
             if ((scene->doFog) && (i > dlimit) ){ // near the fog limit
@@ -142,56 +128,320 @@ void rayCast(volatile ApplicationGlobalState *state, NgScenePtr scene, SDL_Surfa
                 b = (int)((b * fs) + (fo * skyB));//sky_B[idx])
             }
 
-            if (ir+1 < iz) { // large texels, repeat texture sample
-                // TODO: instead of repeating, we should use a 'fine' texture
-                //       this could be based on another map, which would let us do walls etc.
-                for (int k = iz; k > ir; k--) {
-                    base[ypos+xpos  ] = (BYTE)b; base[ypos+xpos+1] = (BYTE)g; base[ypos+xpos+2] = (BYTE)r;
-
-                    // TODO: back-maps
-                    depths[yline+line] = i;
-                    //coords[???] = ???
-                    yline -= scrWidth;
-                    ypos -= rowBytes;
-                }
-            } else { // small texels. Could super-sample for quality?
-                base[ypos+xpos  ] = (BYTE)b; base[ypos+xpos+1] = (BYTE)g; base[ypos+xpos+2] = (BYTE)r;
-
-                // TODO: back-maps
-                depths[yline+line] = i;
-                //coords[???] = ???
-                yline -= scrWidth;
-                ypos -= rowBytes;
-            }
+            // large texels repeat the texture sample
+            // TODO: instead of repeating, we should use a 'fine' texture
+            //       this could be based on another map, which would let us do walls etc.
+            int rows = (ir+1 < iz) ? (iz - ir) : 1;
+            SpanBufferAdd(spans, line, max(0, cursor - rows + 1), cursor, PACK_RGB(r, g, b), 0, i,
+                          PACK_MAP_COORD(originX + x, originY + y));
+            cursor -= rows;
         } else { // obscured
             //gap = 1;
         }
         ymin = min(ymin, (int)z3);
-        if (ymin < 1) { break; } // early exit: the screen is full
+        if (ymin < 1 || cursor < 0) { break; } // early exit: the screen is full
     } // end of draw distance
 
     // now if we didn't get to the top of the screen, fill in with sky
-    while (ypos > 0) {
-        base[ypos+xpos  ] = (BYTE)skyB; base[ypos+xpos+1] = (BYTE)skyG; base[ypos+xpos+2] = (BYTE)skyR;
-        depths[yline+line] = (BYTE)-1;
+    if (cursor >= 0) {
+        SpanBufferAdd(spans, line, 0, cursor, PACK_RGB(skyR, skyG, skyB), 0, SKY_DEPTH, 0);
+    }
+}
+
+// Per-frame lookup tables for the fixed-point ray marcher.
+// Built once per frame in `RenderScene`, and read-only while columns are drawn.
+typedef struct MarchTables {
+    int steps; // number of map steps to take
+    int32_t camPitch; // camera pitch in screen rows, 16.16
+    int32_t heightOffset[256]; // camera height above terrain, for each height map value. 16.16
+    int32_t peakOffset[256]; // smallest `heightOffset` of this height map value or any lower one. 16.16
+
+    // map tiles, each with a full size map and half size maps for each level of detail after that
+    const TileWindow *window;
+    int levels;
+
+    // for each step:
+    int32_t depth[MAX_VIEW_DISTANCE]; // distance from camera, in map texels (minus one)
+    uint32_t recip[MAX_VIEW_DISTANCE]; // 1/distance, 8.24
+    int32_t fog[MAX_VIEW_DISTANCE]; // fog blend. 0 = no fog, 256 = all sky
+    BYTE level[MAX_VIEW_DISTANCE]; // level of detail. Step length is 2^level texels
+    int levelEnd[MAX_LOD_LEVELS]; // one past the last step of each level. Levels only go up, one after another
+
+    // empty space skipping
+    bool skipBlocks;
+    int16_t stepAt[MAX_VIEW_DISTANCE + 2]; // first step at or past each distance from the camera. `steps` if none
+} MarchTables;
+
+static MarchTables marchTables = {};
+static TileWindow tileWindow = {};
+static int lastDrawnWidth = 0; // columns ray cast across the screen last frame
+
+#define FIXED(v) ((int32_t)((v) * 65536.0))
+// Smallest block tried when skipping empty space: 2^SKIP_MIN_SHIFT texels square. Smaller blocks are rarely
+// skipped far enough to pay for the try
+#define SKIP_MIN_SHIFT 4
+
+double SceneTerrainHeight(NgScenePtr scene, int mapHeight) {
+    double terrainHeight = mapHeight * scene->heightScale;
+    if (mapHeight <= scene->waterLevel) terrainHeight = scene->waterLevel;
+    if (scene->sharperPeaks) terrainHeight *= terrainHeight / 127.0;
+    return terrainHeight;
+}
+
+void BuildMarchTables(MarchTables *tables, const TileWindow *window, NgScenePtr scene) {
+    int viewDistance = min(TileCacheViewDistance(), scene->VIEW_DISTANCE); // never more than MAX_VIEW_DISTANCE
+    tables->camPitch = FIXED(scene->camPitch);
+
+    // terrain height, with the same water and peak adjustments as `rayCast`
+    for (int i = 0; i < 256; i++) {
+        tables->heightOffset[i] = FIXED(scene->camHeight - SceneTerrainHeight(scene, i));
+        tables->peakOffset[i] = (i > 0) ? min(tables->peakOffset[i - 1], tables->heightOffset[i]) : tables->heightOffset[i];
+    }
+
+    // map levels
+    tables->window = window;
+    tables->levels = (scene->lodMarching) ? (MAX_LOD_LEVELS) : (1);
+
+    // Step along the ray. Without LOD, every step is one texel.
+    // With LOD, step length doubles every `lodDistance` texels (up to the smallest mip level)
+    // and we sample from the matching mip level.
+    int lodDistance = max(1, scene->lodDistance);
+    double dlimit = viewDistance * 0.7;
+    double dfog = 1 / (viewDistance * 0.3);
+    int dist = 1;
+    int level = 0;
+    int nextLevelAt = lodDistance;
+    int steps = 0;
+    while (dist <= viewDistance && steps < MAX_VIEW_DISTANCE) {
+        int i = dist - 1; // same as the step count in `rayCast`
+        tables->depth[steps] = i;
+        tables->recip[steps] = (uint32_t)((1 << 24) / dist);
+        tables->fog[steps] = (scene->doFog && i > dlimit) ? (int32_t)(256 * dfog * (i - dlimit)) : 0;
+        tables->level[steps] = (BYTE)level;
+        steps++;
+
+        dist += 1 << level;
+        if (dist >= nextLevelAt && level + 1 < tables->levels) {
+            level++;
+            nextLevelAt *= 2;
+            dist = (dist + (1 << level) - 1) & ~((1 << level) - 1); // keep steps aligned to the level
+        }
+    }
+    tables->steps = steps;
+    for (int l = 0; l < MAX_LOD_LEVELS; l++) tables->levelEnd[l] = 0;
+    for (int s = 0; s < steps; s++) tables->levelEnd[tables->level[s]] = s + 1;
+
+    tables->skipBlocks = scene->skipEmptySpace;
+    int step = 0;
+    for (int d = 0; d < MAX_VIEW_DISTANCE + 2; d++) {
+        while (step < steps && tables->depth[step] + 1 < d) step++;
+        tables->stepAt[d] = (int16_t)step;
+    }
+}
+
+// Distance along a ray where it leaves the square block of 2^shift texels holding window texel (x, y).
+// Every step nearer than this is inside the block. Rounded down where in doubt, so it can be early but never late.
+// `rayX`, `rayY` = camera in window space, `invX`, `invY` = 1 / ray direction, or 0 if the ray is parallel to that axis
+static inline int blockExit(double rayX, double rayY, double invX, double invY, int x, int y, int shift) {
+    double exit = MAX_VIEW_DISTANCE + 1;
+    if (invX > 0) exit = min(exit, ((((x >> shift) + 1) << shift) - rayX) * invX);
+    else if (invX < 0) exit = min(exit, (((x >> shift) << shift) - rayX) * invX);
+    if (invY > 0) exit = min(exit, ((((y >> shift) + 1) << shift) - rayY) * invY);
+    else if (invY < 0) exit = min(exit, (((y >> shift) << shift) - rayY) * invY);
+    return (int)(exit + 0.99);
+}
+
+// How much further a ray can go and stay in the tile spanning [low, low + TILE_SIZE) texels on one axis.
+// `pos` is where the ray is now, inside the tile, and `step` how far it moves per texel of distance (both 16.16)
+static inline int tileExitAt(int32_t pos, int32_t step, int low) {
+    if (step > 0) return (int)(((((int64_t)low + TILE_SIZE) << 16) - 1 - pos) / step);
+    if (step < 0) return (int)((pos - ((int64_t)low << 16)) / -step);
+    return MAX_VIEW_DISTANCE + 1;
+}
+
+// Fixed-point (16.16) version of `rayCast`, driven by the per-frame `MarchTables`.
+// Map steps use integer positions and a table multiply in place of the perspective divide.
+// Output matches `rayCast` to within rounding (unless level-of-detail steps are on).
+// Visible texels are added to `spans` with fog still to be applied by `SpanBufferShade`.
+//
+// With `skipBlocks`, before reading a texel the marcher looks at the peak heights of the blocks around it,
+// smallest first. If the highest point of a block would project below everything drawn so far (`ymin`) at
+// every distance the ray spends inside it, the block can be stepped over, and the next size up is tried.
+// Blocks are only tried after a hidden step, and after a failed try none are tried again for a while (longer
+// after each failure in a row), so rays over visible ground pay very little for it.
+void rayCastFixed(volatile ApplicationGlobalState *state, const MarchTables *tables, NgScenePtr scene, SpanBuffer *spans, int height,
+                  int line, double x1, double y1, double x2, double y2, double d) {
+
+    if (state == nullptr || scene == nullptr) return;
+
+    // Maps we read from. These change as we cross into another tile, or step out through the levels of detail
+    const TileWindow *window = tables->window;
+    int litCopy = window->litCopy;
+    int level = 0;
+    int tileIndex = -1; // tile that `texels` are from
+    const MapTile* tile = nullptr;
+    const uint32_t* texels = nullptr; // lit color and height
+
+    // unit step along the ray, in map space
+    double dx = x2 - x1;
+    double dy = y2 - y1;
+    double dr = sqrt(dx * dx + dy * dy);
+    dx /= dr;
+    dy /= dr;
+
+    // camera in window space, where tile `window->tiles[0]` starts at 0,0
+    int32_t camX = FIXED(x1 - (window->originX * (double)TILE_SIZE));
+    int32_t camY = FIXED(y1 - (window->originY * (double)TILE_SIZE));
+    int32_t fdx = FIXED(dx), fdy = FIXED(dy);
+
+    // the same ray in doubles, for finding where it leaves a block
+    double rayX = camX / 65536.0, rayY = camY / 65536.0;
+    double invX = (fdx != 0) ? (65536.0 / fdx) : 0;
+    double invY = (fdy != 0) ? (65536.0 / fdy) : 0;
 
-        yline -= scrWidth;
-        ypos -= rowBytes;
+    // perspective scale for this column (1/dp in `rayCast`), 16.16
+    int64_t colScale = FIXED(100.0 / fabs(d));
+    int64_t camV = tables->camPitch;
+
+    int ymin = height; // last place we ended drawing a vertical line
+    int hbound = height - 1;
+    int cursor = hbound; // next row to draw
+
+    uint32_t sky = PACK_RGB(scene->sky_R, scene->sky_G, scene->sky_B);
+
+    int windowTexels = TILE_WINDOW_SPAN * TILE_SIZE;
+    int originX = window->originX * TILE_SIZE, originY = window->originY * TILE_SIZE; // window space to map texels
+    int steps = tables->steps;
+    int skipFrom = tables->skipBlocks ? 0 : MAX_VIEW_DISTANCE + 2; // distance to next try to skip a block
+    bool lastHidden = true; // the last texel read was hidden. Visible ground is rarely worth trying to skip
+    int failedTries = 0; // in a row. Each one waits twice as long before the next
+
+    // The steps are taken in runs that stay on one level of detail and in one tile, up to the next try to skip.
+    // Each run starts with the checks for all of those, then steps with nothing but the texel read and projection
+    int i = 0;
+    while (i < steps) {
+        int depth = tables->depth[i];
+        if (tables->level[i] != level) { // stepped out to the next level of detail
+            level = tables->level[i];
+            tileIndex = -1;
+        }
+
+        int distance = depth + 1;
+        int32_t posX = camX + fdx * distance;
+        int32_t posY = camY + fdy * distance;
+        int x = posX >> 16;
+        int y = posY >> 16;
+        if (x < 0 || x >= windowTexels) break; // outside the window
+        if (y < 0 || y >= windowTexels) break;
+
+        int t = ((y >> TILE_SHIFT) * TILE_WINDOW_SPAN) + (x >> TILE_SHIFT);
+        if (t != tileIndex) { // crossed into another tile
+            tile = window->tiles[t];
+            if (tile == nullptr) break; // not loaded yet
+            tileIndex = t;
+            texels = tile->litLevels[litCopy][level];
+        }
+
+        if (lastHidden && distance >= skipFrom) { // try to step over empty space
+            // Highest the screen row can be to still hide a block, 16.16 before the pitch, at each distance.
+            // One row spare covers rounding in the reciprocal table
+            int64_t hideLimit = ((int64_t)ymin << 16) + camV + 65536;
+            int skipTo = 0;
+            for (int shift = max(SKIP_MIN_SHIFT, level); shift <= TILE_SHIFT; shift += 2) { // mips must fit in the block
+                int rowShift = TILE_SHIFT - shift; // blocks across a tile, as a power of two
+                BYTE peak = tile->peakLevels[shift][(((y & TILE_MASK) >> shift) << rowShift) + ((x & TILE_MASK) >> shift)];
+
+                // The block's peak projects highest at its furthest point if it's below the camera, or nearest if above.
+                // The ray leaves the block within one diagonal, so test against that before finding where exactly
+                int64_t h = ((int64_t)tables->peakOffset[peak] * colScale) >> 16;
+                int64_t highestAt = (h >= 0) ? (distance + ((3 << shift) >> 1)) : distance;
+                if (h < hideLimit * highestAt) { // could be seen
+                    if (skipTo == 0) skipFrom = distance + ((1 << shift) << min(failedTries, 4));
+                    break;
+                }
+                int exit = blockExit(rayX, rayY, invX, invY, x, y, shift);
+                if (exit <= distance) break;
+                int lastInside = tables->stepAt[min(exit, MAX_VIEW_DISTANCE + 1)] - 1;
+                if (tables->level[lastInside] > shift) break; // steps that far out read mips wider than the block
+                skipTo = exit;
+            }
+            if (skipTo > 0) {
+                failedTries = 0;
+                i = tables->stepAt[min(skipTo, MAX_VIEW_DISTANCE + 1)];
+                continue;
+            }
+            skipFrom = max(skipFrom, distance + 1);
+            failedTries++;
+        }
+
+        // end of the run: the last step in this tile or on this level. A hidden step before the next try to skip ends it early
+        int tileX = x & ~TILE_MASK, tileY = y & ~TILE_MASK;
+        int inTile = distance + min(tileExitAt(posX, fdx, tileX), tileExitAt(posY, fdy, tileY));
+        int runEnd = min(tables->levelEnd[level], (int)tables->stepAt[min(inTile + 1, MAX_VIEW_DISTANCE + 1)]);
+        int tryAt = tables->stepAt[min(skipFrom, MAX_VIEW_DISTANCE + 1)];
+        int32_t stepX = fdx << level, stepY = fdy << level;
+        int levelShift = 2 * level;
+        const int32_t* heightOffset = tables->heightOffset;
+        const uint32_t* recip = tables->recip;
+        int64_t rowLimit = ((int64_t)ymin << 16) + camV; // projections at or past this are hidden
+        bool full = false;
+
+        for (; i < runEnd; i++) {
+            int idx = (TileTexelIndex((posX >> 16) & TILE_MASK, (posY >> 16) & TILE_MASK, 0)) >> levelShift;
+            uint32_t texel = texels[idx]; // the only map read for this step
+
+            // projected screen row of this map position, 16.16 before the pitch
+            int64_t h = heightOffset[TEXEL_HEIGHT(texel)];
+            int64_t z = (((h * colScale) >> 16) * recip[i]) >> 24;
+
+            if (z < rowLimit) { // visible
+                int z3 = (int)((z - camV) >> 16); // floor to pixel bounds
+                int ir = min(hbound, max(0, z3));
+                int iz = min(hbound, ymin);
+
+                int rows = (ir + 1 < iz) ? (iz - ir) : 1; // always at least one row, repeat for large texels
+                SpanBufferAdd(spans, line, max(0, cursor - rows + 1), cursor, TEXEL_COLOR(texel), (uint32_t)tables->fog[i],
+                              tables->depth[i], PACK_MAP_COORD(originX + (posX >> 16), originY + (posY >> 16)));
+                cursor -= rows;
+
+                ymin = z3;
+                rowLimit = ((int64_t)ymin << 16) + camV;
+                lastHidden = false;
+                if (ymin < 1 || cursor < 0) { full = true; break; } // early exit: the screen is full
+            } else {
+                lastHidden = true;
+                if (i + 1 >= tryAt) { i++; break; } // the next step tries to skip
+            }
+            posX += stepX;
+            posY += stepY;
+        }
+        if (full) break;
+    }
+
+    // now if we didn't get to the top of the screen, fill in with sky
+    if (cursor >= 0) {
+        SpanBufferAdd(spans, line, 0, cursor, sky, 0, SKY_DEPTH, 0);
     }
 }
 
 void InitScene(volatile ApplicationGlobalState *state){
     auto scene = (NgScenePtr)ArenaAllocate(MMCurrent(),sizeof(NgScene));
-    scene-> VIEW_DISTANCE = 600; // how far to draw. More is slower but you can see further (range: 400 to 2000)
+    scene-> VIEW_DISTANCE = 600; // how far to draw. More is slower but you can see further (range: 400 to MAX_VIEW_DISTANCE). Sizes the tile cache at start up
 
     scene-> doInterlacing = true; // render alternate columns per frame for motion blur
+    scene-> adaptiveResolution = true; // draw fewer columns when frames run long (G key)
     scene-> doFog = true; // fade to background near draw limit
+    scene-> fixedPointMarch = true; // use the integer ray marcher
+    scene-> lodMarching = true; // longer steps and smaller maps in the distance (fixed-point marcher only)
+    scene-> lodDistance = 400; // distance at which LOD steps start to grow
+    scene-> skipEmptySpace = true; // skip blocks too low to be seen
+    scene-> columnMajorTarget = false; // draw into a column-major buffer, then copy to the screen
+    scene-> drawSprites = true; // creatures
     scene-> sharperPeaks = false; // change scaling to make hills into mountains
 
     scene->waterLevel = 51; //51;
     scene->shadowAngle = 45;
 
-    scene-> interlace = 0;
     scene-> aspect = SCREEN_WIDTH; // camera aspect. Smaller = fisheye. Ideally equal to screen width
     scene-> heightScale = 1.1; // scale of slopes. Higher = taller mountains.
 
@@ -205,12 +455,12 @@ void InitScene(volatile ApplicationGlobalState *state){
     state->scene = scene;
 }
 
-void SetSkyColor(volatile const ApplicationGlobalState *state, NgScenePtr scene) {
+void SetSkyColor(NgScenePtr scene) {
     scene->sky_R = 80; // general gloom
     scene->sky_G = 20;
     scene->sky_B = 0;
-    double sunrad = 0.017453 * state->scene->shadowAngle;
-    if (state->scene->shadowAngle > 0 && state->scene->shadowAngle < 180) {
+    double sunrad = 0.017453 * scene->shadowAngle;
+    if (scene->shadowAngle > 0 && scene->shadowAngle < 180) {
         double csr = cos(sunrad + 3.1415);
         int b = 300 - (int) fabs( csr * 300);
         int g = 275 - (int)fabs(csr * 255);
@@ -222,45 +472,184 @@ void SetSkyColor(volatile const ApplicationGlobalState *state, NgScenePtr scene)
     }
 }
 
-void RenderScene(volatile ApplicationGlobalState *state, SDL_Surface *screen) {
-    auto scene = state->scene;
+// Everything a render job needs to draw its band of columns.
+// Filled once per frame, and read-only while the jobs run.
+typedef struct ColumnBatch {
+    volatile ApplicationGlobalState *state;
+    NgScenePtr scene;
+    SDL_Surface *screen;
+    RenderTarget target;
+    const MarchTables *tables;
+    const TileWindow *window;
+
+    double sinAngle, cosAngle;
+    double y3d;
+    double camX, camY;
+
+    double columnSpread; // screen columns for each column ray cast. More than 1 when the frame is stretched
+    int firstColumn; // first column drawn this frame (interlace offset)
+    int columnStep; // 1, or 2 when interlacing
+    int columnCount; // number of columns drawn this frame
+    int bandCount; // number of jobs the columns are split into
+} ColumnBatch;
+
+// Render one band of screen columns. Each column only writes to its own pixels
+void renderColumnBand(void* context, int band) {
+    auto batch = (ColumnBatch*)context;
+    double hw = batch->screen->w / 2.0;
+    double spread = batch->columnSpread;
+    int height = batch->screen->h;
+    double y3d = batch->y3d;
+    bool fixedPoint = batch->scene->fixedPointMarch;
+    const RenderTarget* target = &batch->target;
+
+    int start = (batch->columnCount * band) / batch->bandCount;
+    int end = (batch->columnCount * (band + 1)) / batch->bandCount;
+
+    // spans from several columns are shaded and drawn together
+    SpanBuffer spans;
+    spans.count = 0;
+    uint32_t sky = PACK_RGB(batch->scene->sky_R, batch->scene->sky_G, batch->scene->sky_B);
+
+    for (int c = start; c < end; c++) {
+        if (SpanBufferSpace(&spans) <= height) SpanBufferFlush(&spans, sky, target);
+
+        int i = batch->firstColumn + (c * batch->columnStep);
+        double x3d = ((((i + 0.5) * spread) - 0.5) - hw) * 2.25; // the middle of the screen columns this one covers
+
+        double rotX =  batch->cosAngle * x3d + batch->sinAngle * y3d;
+        double rotY = -batch->sinAngle * x3d + batch->cosAngle * y3d;
+
+        double d = y3d / sqrt(x3d * x3d + y3d * y3d);
+
+        if (fixedPoint) {
+            rayCastFixed(batch->state, batch->tables, batch->scene, &spans, height,
+                         i, batch->camX, batch->camY,
+                         batch->camX + rotX, batch->camY + rotY, d);
+        } else {
+            rayCast(batch->state, batch->window, batch->scene, &spans, height,
+                    i, batch->camX, batch->camY,
+                    batch->camX + rotX, batch->camY + rotY, d);
+            /*, camAngle);*/ // for sky texture
+        }
+    }
+    SpanBufferFlush(&spans, sky, target);
+}
+
+// Copy one band of rows from the column-major target to the screen, depth map and coordinate map
+void blitRowBand(void* context, int band) {
+    auto batch = (ColumnBatch*)context;
+    const RenderTarget* target = &batch->target;
+    SDL_Surface* screen = batch->screen;
+
+    int start = (target->height * band) / batch->bandCount;
+    int end = (target->height * (band + 1)) / batch->bandCount;
+
+    if (target->width < screen->w) { // fewer columns were drawn, see `ResolutionNextWidth`
+        StretchToRows(target->pixels, target->width, target->height, (uint32_t*)screen->pixels, screen->w, screen->pitch / 4, start, end);
+        StretchToRows(target->depths, target->width, target->height, batch->state->depthMap, screen->w, screen->w, start, end);
+        StretchToRows(target->coords, target->width, target->height, batch->state->coordMap, screen->w, screen->w, start, end);
+        return;
+    }
+    TransposeToRows(target->pixels, target->width, target->height, (uint32_t*)screen->pixels, screen->pitch / 4, start, end);
+    TransposeToRows(target->depths, target->width, target->height, batch->state->depthMap, screen->w, start, end);
+    TransposeToRows(target->coords, target->width, target->height, batch->state->coordMap, screen->w, start, end);
+}
+
+void RenderScene(volatile ApplicationGlobalState *state, NgScenePtr scene, SDL_Surface *screen) {
     if (scene == nullptr) return;
 
-    // draw terrain
-    double sinAngle = sin(scene->camAngle);
-    double cosAngle = cos(scene->camAngle);
+    ColumnBatch batch = {};
+    batch.state = state;
+    batch.scene = scene;
+    batch.screen = screen;
+
+    // where spans are drawn
+    bool fitsBuffers = screen->w <= SCREEN_WIDTH && screen->h <= SCREEN_HEIGHT;
+    bool columnBuffers = state->columnPixels != nullptr && fitsBuffers;
 
-    double y3d = -(scene->aspect) * 1.5;
-    int di = (scene->doInterlacing) ? (2) : (1);
+    // columns to ray cast. Fewer than the screen width are stretched across it when copied to the screen
     int width = screen->w;
+    if (columnBuffers && state->renderWidth > 0) width = min(screen->w, state->renderWidth);
+    bool scaled = width < screen->w;
+    bool widthChanged = width != lastDrawnWidth; // columns kept from the last frame don't line up
+    lastDrawnWidth = width;
+    state->renderWidth = scaled ? width : 0; // what was really drawn, for the resolution controller
+    batch.columnSpread = screen->w / (double)width;
+
+    bool columnMajor = (scene->columnMajorTarget || scaled) && columnBuffers;
+    if (columnMajor) {
+        batch.target = ColumnTarget(state->columnPixels, state->columnDepths, state->columnCoords, width, screen->h);
+    } else {
+        batch.target = SurfaceTarget(screen, state->depthMap, state->coordMap);
+    }
 
-    double camX = scene->camX;
-    double camY = scene->camY;
-    //double camAngle = scene->camAngle;
-    int angleOffNoon = (int)(90 - state->scene->shadowAngle);
-    int shadowDarkness = min(255, max(0, (angleOffNoon*angleOffNoon) / 200));
+    // draw terrain
+    batch.sinAngle = sin(scene->camAngle);
+    batch.cosAngle = cos(scene->camAngle);
+    batch.y3d = -(scene->aspect) * 1.5;
+    batch.camX = scene->camX;
+    batch.camY = scene->camY;
+
+    // map tiles in view. Missing ones are loaded in the background
+    TileCacheBuildWindow(&tileWindow, scene->camX, scene->camY, min(TileCacheViewDistance(), scene->VIEW_DISTANCE), state->litCopy);
+    batch.window = &tileWindow;
+
+    SetSkyColor(scene);
+    if (scene->fixedPointMarch) {
+        BuildMarchTables(&marchTables, &tileWindow, scene);
+        batch.tables = &marchTables;
+    }
 
-    SetSkyColor(state, scene);
+    // increment by 2 for interlacing
+    bool interlace = scene->doInterlacing && !widthChanged;
+    batch.firstColumn = (interlace) ? (state->interlace) : (0);
+    batch.columnStep = (interlace) ? (2) : (1);
+    batch.columnCount = (width - batch.firstColumn + batch.columnStep - 1) / batch.columnStep;
 
-    for (int i = scene->interlace; i < width; i+= di){ //increment by 2 for interlacing
-        double hw = width / 2.0;
-        double x3d = (i - hw) * 2.25;
+    // a few bands per thread, so threads that hit cheap (sky filled) columns can pick up more work
+    batch.bandCount = JobPoolThreadCount() * RENDER_BANDS_PER_THREAD;
+    if (batch.bandCount > batch.columnCount) batch.bandCount = batch.columnCount;
 
-        double rotX =  cosAngle * x3d + sinAngle * y3d;
-        double rotY = -sinAngle * x3d + cosAngle * y3d;
+    JobPoolRun(renderColumnBand, &batch, batch.bandCount); // returns when every column is drawn
 
-        rayCast(state, scene, screen,
-                shadowDarkness,
-                i, camX, camY,
-                camX + rotX, camY + rotY,
-                y3d / sqrt(x3d * x3d + y3d * y3d));
-        /*, camAngle);*/ // for sky texture
+    // creatures, over the terrain just drawn and hidden by it
+    bool drawSprites = scene->drawSprites && state->sprites != nullptr;
+    bool spritesOnScreen = scaled; // drawn at the screen's own resolution, after the copy
+    if (drawSprites && !spritesOnScreen) {
+        DrawSprites(scene, &tileWindow, &batch.target, state->sprites, state->spriteCount, batch.firstColumn, batch.columnStep);
     }
 
-    // alternate scanlines each frame
-    scene->interlace = 1 - scene->interlace;
-}
-
+    if (columnMajor) { // copy the whole buffer, so columns skipped by interlacing keep their last frame
+        batch.bandCount = JobPoolThreadCount() * RENDER_BANDS_PER_THREAD;
+        JobPoolRun(blitRowBand, &batch, batch.bandCount);
+    }
+    if (drawSprites && spritesOnScreen) { // every column is new on the screen
+        RenderTarget screenTarget = SurfaceTarget(screen, state->depthMap, state->coordMap);
+        DrawSprites(scene, &tileWindow, &screenTarget, state->sprites, state->spriteCount, 0, 1);
+    }
 
+    // the coordinate map is unpacked around the camera it was drawn from, not wherever the live scene has moved to
+    state->coordMapCamX = (int)floor(scene->camX);
+    state->coordMapCamY = (int)floor(scene->camY);
 
+    // alternate scanlines each frame
+    state->interlace = 1 - state->interlace;
+}
 
+bool PickMapCoord(volatile ApplicationGlobalState *state, int screenX, int screenY, int *mapX, int *mapY, uint32_t *depth) {
+    if (state == nullptr || state->coordMap == nullptr || state->depthMap == nullptr) return false;
+    if (screenX < 0 || screenX >= SCREEN_WIDTH || screenY < 0 || screenY >= SCREEN_HEIGHT) return false;
+
+    int i = (screenY * SCREEN_WIDTH) + screenX;
+    uint32_t d = state->depthMap[i];
+    if (depth != nullptr) *depth = d;
+    if (d == SKY_DEPTH) return false;
+
+    // the stored texel is the one nearest the camera with the same low 16 bits
+    uint32_t coord = state->coordMap[i];
+    int camX = state->coordMapCamX, camY = state->coordMapCamY;
+    if (mapX != nullptr) *mapX = camX + (int16_t)(uint16_t)((coord >> 16) - (uint32_t)camX);
+    if (mapY != nullptr) *mapY = camY + (int16_t)(uint16_t)((coord & 0xFFFFu) - (uint32_t)camY);
+    return true;
+}
@@ -10,10 +10,28 @@
 #include "scene.h"
 #include "shared_types.h"
 
+// Upper limit for `NgScene::VIEW_DISTANCE`
+#define MAX_VIEW_DISTANCE 2000
+// Number of map sizes used for level-of-detail ray marching, including the full size map
+#define MAX_LOD_LEVELS 5
+// Depth map value for pixels that show the sky
+#define SKY_DEPTH 0xFFFFFFFF
+// Coordinate map value: the low 16 bits of a global map texel position, x in the top half and y in the bottom.
+// Everything drawn is within `MAX_VIEW_DISTANCE` of the camera, so `PickMapCoord` can restore the full position.
+#define PACK_MAP_COORD(x, y) ((((uint32_t)(x) & 0xFFFFu) << 16) | ((uint32_t)(y) & 0xFFFFu))
 
 void InitScene(volatile ApplicationGlobalState *state);
 
+// Height of the terrain surface for a height map value, with the scene's scale, water level and peak settings
+double SceneTerrainHeight(NgScenePtr scene, int mapHeight);
+
 void MoveCamera(NgScenePtr scene, Vec3 &eye, Vec3 &lookAt);
-void RenderScene(volatile ApplicationGlobalState *state, SDL_Surface *screen);
+// Draw `scene` to the screen. `scene` is normally the render thread's snapshot (see `SceneSnapshotLatest`),
+// and may be written to while drawing (sky color).
+void RenderScene(volatile ApplicationGlobalState *state, NgScenePtr scene, SDL_Surface *screen);
+
+// Map texel and depth drawn at a screen position in the last frame, from the coordinate and depth maps.
+// Returns false for the sky, or a point off the screen. `depth` can be null.
+bool PickMapCoord(volatile ApplicationGlobalState *state, int screenX, int screenY, int *mapX, int *mapY, uint32_t *depth);
 
 #endif //SDLBASE_SCENE_H
@@ -0,0 +1,24 @@
+#include "scene_snapshot.h"
+
+void SceneSnapshotInit(SceneSnapshots* snapshots, const NgScene* initial) {
+    for (int i = 0; i < 3; i++) snapshots->buffers[i] = *initial;
+    snapshots->writing = 0;
+    snapshots->reading = 1;
+    SDL_AtomicSet(&snapshots->ready, 2);
+}
+
+void SceneSnapshotPublish(SceneSnapshots* snapshots, const NgScene* scene) {
+    snapshots->buffers[snapshots->writing] = *scene;
+
+    // SDL_AtomicSet is a full barrier, so the copy is complete before the reader can see it
+    int old = SDL_AtomicSet(&snapshots->ready, snapshots->writing | SCENE_SNAPSHOT_NEW);
+    snapshots->writing = old & ~SCENE_SNAPSHOT_NEW; // either a stale snapshot, or one the reader gave back
+}
+
+NgScenePtr SceneSnapshotLatest(SceneSnapshots* snapshots) {
+    if (SDL_AtomicGet(&snapshots->ready) & SCENE_SNAPSHOT_NEW) {
+        int old = SDL_AtomicSet(&snapshots->ready, snapshots->reading);
+        snapshots->reading = old & ~SCENE_SNAPSHOT_NEW;
+    }
+    return &snapshots->buffers[snapshots->reading];
+}
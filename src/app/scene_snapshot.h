@@ -0,0 +1,38 @@
+#ifndef SDLBASE_SCENE_SNAPSHOT_H
+#define SDLBASE_SCENE_SNAPSHOT_H
+
+#include <SDL_atomic.h>
+#include "shared_types.h"
+
+/*
+    Triple-buffered copies of the scene, handed from the update thread to the render thread without locks.
+
+    The update thread copies its scene into the buffer it owns and publishes it, swapping that buffer
+    for the previously published one. The render thread takes the latest published buffer at the start
+    of each frame, swapping it for the one it drew last. Each thread always has a buffer of its own,
+    so neither ever waits, and the renderer sees every field of a scene from the same update.
+
+    Only one thread may publish, and only one thread may take snapshots.
+*/
+
+// Set in `SceneSnapshots::ready` when a buffer has been published and not yet taken
+#define SCENE_SNAPSHOT_NEW 4
+
+typedef struct SceneSnapshots {
+    NgScene buffers[3];
+    SDL_atomic_t ready; // index of the last published buffer, plus SCENE_SNAPSHOT_NEW if not yet taken
+    int writing; // buffer owned by the update thread
+    int reading; // buffer owned by the render thread
+} SceneSnapshots;
+
+// Fill all three buffers with `initial`
+void SceneSnapshotInit(SceneSnapshots* snapshots, const NgScene* initial);
+
+// Update thread: copy `scene` and make it the latest snapshot
+void SceneSnapshotPublish(SceneSnapshots* snapshots, const NgScene* scene);
+
+// Render thread: get the latest snapshot. If nothing new has been published, the last one is returned again.
+// The result is owned by the render thread until the next call.
+NgScenePtr SceneSnapshotLatest(SceneSnapshots* snapshots);
+
+#endif //SDLBASE_SCENE_SNAPSHOT_H
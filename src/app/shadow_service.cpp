@@ -0,0 +1,175 @@
+#include "shadow_service.h"
+#include "job_pool.h"
+#include "tile_cache.h"
+#include "types/MemoryManager.h"
+
+#include <SDL.h>
+#include <SDL_mutex.h>
+#include <SDL_thread.h>
+#include <SDL_atomic.h>
+
+// Rows updated per job pool batch. Keeps each batch short, so the renderer never waits long for the pool
+#define SHADOW_BATCH_ROWS 64
+
+static SDL_Thread* serviceThread = nullptr;
+static SDL_sem* requestSignal = nullptr; // posted when a new sun angle is asked for
+static SDL_sem* takenSignal = nullptr; // posted by the render thread when it moves to a newly published copy
+static SDL_mutex* requestLock = nullptr;
+static volatile bool stopping = false;
+
+static double requestedAngle = 0.0;
+static bool requestPending = false;
+
+static MapTile* relit[TILE_CACHE_SLOTS]; // tiles being relit
+static BYTE* paddedLight = nullptr; // light map with apron, for the tile being relit
+static SDL_atomic_t published; // copy the renderer should use next
+static SDL_atomic_t inUse; // copy the renderer is using now
+
+typedef struct ShadowBatch {
+    MapTile* tile;
+    int copy;
+    double sunAngle;
+    bool litPass; // false: padded light rows. true: tile light and lit color rows
+    int firstRow;
+    int endRow;
+    int rowsPerJob;
+} ShadowBatch;
+
+static void shadowRowsJob(void* context, int jobIndex) {
+    auto batch = (ShadowBatch*)context;
+    int first = batch->firstRow + (jobIndex * batch->rowsPerJob);
+    int end = first + batch->rowsPerJob;
+    if (end > batch->endRow) end = batch->endRow;
+
+    if (batch->litPass) {
+        TileLitRows(batch->tile, paddedLight, batch->copy, first, end);
+    } else {
+        TileLightRows(batch->tile, paddedLight, batch->sunAngle, first, end);
+    }
+}
+
+// run one pass over `rows` rows in short batches
+static void runRows(ShadowBatch* batch, int rows) {
+    for (int row = 0; row < rows; row += SHADOW_BATCH_ROWS) {
+        batch->firstRow = row;
+        batch->endRow = row + SHADOW_BATCH_ROWS;
+        if (batch->endRow > rows) batch->endRow = rows;
+
+        int count = batch->endRow - batch->firstRow;
+        int threads = JobPoolThreadCount();
+        batch->rowsPerJob = (count + threads - 1) / threads;
+        JobPoolRun(shadowRowsJob, batch, (count + batch->rowsPerJob - 1) / batch->rowsPerJob);
+    }
+}
+
+// take the latest requested angle, if any
+static bool takeRequest(double* sunAngle) {
+    SDL_LockMutex(requestLock);
+    bool pending = requestPending;
+    *sunAngle = requestedAngle;
+    requestPending = false;
+    SDL_UnlockMutex(requestLock);
+    return pending;
+}
+
+static int ShadowWorker(void*) {
+    while (true) {
+        SDL_SemWait(requestSignal);
+        if (stopping) break;
+
+        double sunAngle;
+        if (!takeRequest(&sunAngle)) continue;
+
+        int front = SDL_AtomicGet(&published);
+        int back = 1 - front;
+
+        // the renderer might still be drawing from the back copy. Wait until it has taken the front one
+        while (!stopping && SDL_AtomicGet(&inUse) != front) SDL_SemWait(takenSignal);
+        if (stopping) break;
+
+        // relight the back copy of every tile that's loaded now. Tiles that load later are lit by their loader
+        int count = TileCacheClaimReady(relit, TILE_CACHE_SLOTS);
+        ShadowBatch batch = {};
+        batch.copy = back;
+        batch.sunAngle = sunAngle;
+        for (int i = 0; i < count; i++) {
+            batch.tile = relit[i];
+            batch.litPass = false;
+            runRows(&batch, TILE_PADDED);
+            batch.litPass = true;
+            runRows(&batch, TILE_SIZE);
+            TileLitMips(relit[i], back);
+        }
+        TileCacheRelease(relit, count);
+
+        SDL_AtomicSet(&published, back); // full barrier: the new copy is complete before the renderer can pick it
+    }
+    return 0;
+}
+
+void ShadowServiceStart(double sunAngle) {
+    if (serviceThread != nullptr) return; // already running
+
+    if (paddedLight == nullptr) paddedLight = (BYTE *) MMAllocate(TILE_PADDED * TILE_PADDED);
+
+    SDL_AtomicSet(&published, 0);
+    SDL_AtomicSet(&inUse, 0);
+    stopping = false;
+
+    if (requestLock == nullptr) requestLock = SDL_CreateMutex(); // kept after stopping, tile loaders may still read the angle
+    SDL_LockMutex(requestLock);
+    requestedAngle = sunAngle;
+    requestPending = false;
+    SDL_UnlockMutex(requestLock);
+
+    requestSignal = SDL_CreateSemaphore(0);
+    takenSignal = SDL_CreateSemaphore(0);
+    serviceThread = SDL_CreateThread(ShadowWorker, "ShadowService", nullptr);
+}
+
+void ShadowServiceStop() {
+    if (serviceThread == nullptr) return;
+
+    stopping = true;
+    SDL_SemPost(requestSignal);
+    SDL_SemPost(takenSignal);
+    SDL_WaitThread(serviceThread, nullptr);
+    serviceThread = nullptr;
+
+    SDL_DestroySemaphore(requestSignal);
+    SDL_DestroySemaphore(takenSignal);
+    requestSignal = nullptr;
+    takenSignal = nullptr;
+}
+
+void ShadowServiceRequest(double sunAngle) {
+    if (serviceThread == nullptr) return;
+
+    SDL_LockMutex(requestLock);
+    requestedAngle = sunAngle;
+    requestPending = true;
+    SDL_UnlockMutex(requestLock);
+
+    if (SDL_SemValue(requestSignal) < 1) SDL_SemPost(requestSignal); // one wake-up covers any number of requests
+}
+
+double ShadowServiceLatestAngle() {
+    if (requestLock == nullptr) return requestedAngle;
+
+    SDL_LockMutex(requestLock);
+    double sunAngle = requestedAngle;
+    SDL_UnlockMutex(requestLock);
+    return sunAngle;
+}
+
+void ShadowServiceAcquire(volatile ApplicationGlobalState *state) {
+    if (serviceThread == nullptr || state == nullptr) return;
+
+    int front = SDL_AtomicGet(&published);
+    state->litCopy = front;
+
+    if (SDL_AtomicGet(&inUse) != front) { // let the service know the old copy is free
+        SDL_AtomicSet(&inUse, front);
+        SDL_SemPost(takenSignal);
+    }
+}
@@ -0,0 +1,36 @@
+#ifndef SDLBASE_SHADOW_SERVICE_H
+#define SDLBASE_SHADOW_SERVICE_H
+
+#include "shared_types.h"
+
+/*
+    Recalculates the light maps, and the lit colors drawn by the renderer, on a background thread when the sun moves.
+
+    Every loaded map tile has two copies of its lit colors and their mips. The renderer draws from the front copy while
+    the service fills the back copy of each tile, a few rows at a time across the job pool, then publishes them all
+    by swapping an index. The back copies are only written once the renderer has moved off them, so a frame
+    never sees half-drawn lighting.
+
+    Tiles loaded while an update is running are lit by the tile loaders, in both copies, for the newest angle.
+
+    Requests are merged: if the sun moves several times while an update is running, only the
+    latest angle is drawn next.
+*/
+
+// Start the service, with the sun at `sunAngle`. Tiles are loaded with this lighting until the next request.
+void ShadowServiceStart(double sunAngle);
+
+// Stop and join the service thread. Any update in progress is finished first.
+void ShadowServiceStop();
+
+// Ask for lighting to be redrawn for a new sun angle (0..180). Returns immediately.
+void ShadowServiceRequest(double sunAngle);
+
+// The most recently requested sun angle. Safe to call from any thread
+double ShadowServiceLatestAngle();
+
+// Render thread, at the start of each frame: set `state->litCopy` to the newest complete copy of the lit colors.
+// This must stay the same until the next call.
+void ShadowServiceAcquire(volatile ApplicationGlobalState *state);
+
+#endif //SDLBASE_SHADOW_SERVICE_H
@@ -15,17 +15,23 @@ typedef struct Vec3 {
 #define SET_IN_INIT  0
 
 typedef struct NgScene {
-    int VIEW_DISTANCE = SET_IN_INIT; // how far to draw. More is slower, but you can see further (range: 400 to 2000)
+    int VIEW_DISTANCE = SET_IN_INIT; // how far to draw. More is slower, but you can see further (range: 400 to MAX_VIEW_DISTANCE). The tile cache is sized for it at start up
 
     bool doInterlacing = SET_IN_INIT; // render alternate columns per frame for motion blur
+    bool adaptiveResolution = SET_IN_INIT; // ray cast fewer columns and stretch them across the screen when frames take too long
     bool doFog = SET_IN_INIT; // fade to background near draw limit
     bool sharperPeaks = SET_IN_INIT; // change scaling to make hills into mountains
+    bool fixedPointMarch = SET_IN_INIT; // use the 16.16 fixed-point ray marcher. Otherwise, use the double-precision one
+    bool lodMarching = SET_IN_INIT; // grow ray steps with distance, reading from smaller mip maps. Fixed-point marcher only
+    int lodDistance = SET_IN_INIT; // distance where LOD steps first double, then double again at each multiple of 2
+    bool skipEmptySpace = SET_IN_INIT; // step over map blocks too low to be seen, using each tile's peak heights. Fixed-point marcher only
+    bool columnMajorTarget = SET_IN_INIT; // draw into column-contiguous buffers then transpose to the screen, rather than drawing to the screen directly
+    bool drawSprites = SET_IN_INIT; // draw creature sprites over the terrain
 
 
     double waterLevel = SET_IN_INIT; // global water level. Treated as underwater if below this 0..255
     double shadowAngle = SET_IN_INIT; // 0..180 angle of the sun in sky. Affects shadow shape and darkness
 
-    int interlace = 1;
     int aspect = 512; // camera aspect. Smaller = fisheye
     double heightScale = 1.1; // scale of slopes. Higher = taller mountains.
 
@@ -54,19 +60,31 @@ typedef NgScene* NgScenePtr;
 typedef struct ApplicationGlobalState {
     bool running;
 
-    int mapSize; // height and width of color and height maps
-    BYTE* colorMap; // color map
-    BYTE* shadowMap; // light and shadow values. TODO: move out of colorMap.
-    BYTE* heightMap; // height map
+    // Map tiles are held in the tile cache (see `tile_cache.h`).
+    // Which copy of each tile's lit colors to draw. Swapped by the render thread, see `ShadowServiceAcquire`
+    int litCopy;
     bool showColor;
     bool showHeight;
-    bool showShadow;
+    bool showLight;
     bool showDepth;
-    NgScenePtr scene;
+    NgScenePtr scene; // owned by the update thread. The renderer draws from snapshots of it
+    struct SceneSnapshots* sceneSnapshots; // scene copies handed from update to render thread
+    int interlace; // which set of alternate columns is drawn next. Owned by the render thread
+    int renderWidth; // columns ray cast across the screen, see `ResolutionNextWidth`. 0 = all of them. Owned by the render thread
 
     // screen-sized back reference maps
     uint32_t* depthMap;         // distance from camera
-    uint32_t *coordMap;     // screen point to 16:16 map coords
+    uint32_t* coordMap;         // map texel under each pixel, 16:16 (see `PACK_MAP_COORD` and `PickMapCoord`)
+    int coordMapCamX, coordMapCamY; // camera texel the maps were last drawn from, to unpack `coordMap`
+
+    // creatures in the world, drawn as sprites. Set up in `StartUp`, then read-only
+    const struct Sprite* sprites;
+    int spriteCount;
+
+    // screen-sized column-major buffers, used when `NgScene::columnMajorTarget` is set
+    uint32_t* columnPixels;
+    uint32_t* columnDepths;
+    uint32_t* columnCoords;
 } ApplicationGlobalState;
 
 
@@ -0,0 +1,235 @@
+#include "span_buffer.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SPAN_AVX2 1
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SPAN_SSE2 1
+#endif
+
+// fog one packed color
+inline uint32_t shadeOne(uint32_t color, uint32_t fog, uint32_t sky) {
+    uint32_t result = 0;
+    uint32_t fs = 256 - fog;
+    for (int shift = 0; shift < 24; shift += 8) {
+        uint32_t c = (color >> shift) & 0xFF;
+        uint32_t s = (sky >> shift) & 0xFF;
+        result |= (((c * fs) + (s * fog)) >> 8) << shift;
+    }
+    return result;
+}
+
+void SpanBufferShade(SpanBuffer* spans, uint32_t sky) {
+    int count = spans->count;
+    uint32_t* color = spans->color;
+    uint32_t* fog = spans->fog;
+    int i = 0;
+
+    // Each lane of 4 bytes is one span. For fog, each span is widened to four 16-bit channels,
+    // then blended as c*(256-f) + sky*f >> 8
+#ifdef SPAN_AVX2
+    {
+        __m256i zero = _mm256_setzero_si256();
+        __m256i full = _mm256_set1_epi16(256);
+        __m256i sky16 = _mm256_unpacklo_epi8(_mm256_set1_epi32((int)sky), zero);
+        for (; i + 8 <= count; i += 8) {
+            __m256i c = _mm256_loadu_si256((const __m256i*)(color + i));
+
+            __m256i f = _mm256_loadu_si256((const __m256i*)(fog + i));
+            __m256i f16 = _mm256_packs_epi32(f, f);
+            f16 = _mm256_unpacklo_epi16(f16, f16);
+            __m256i fA = _mm256_unpacklo_epi32(f16, f16); // fog for the low pair of spans in each 128-bit lane
+            __m256i fB = _mm256_unpackhi_epi32(f16, f16); // ... and the high pair
+
+            __m256i cA = _mm256_unpacklo_epi8(c, zero);
+            __m256i cB = _mm256_unpackhi_epi8(c, zero);
+            cA = _mm256_srli_epi16(_mm256_add_epi16(_mm256_mullo_epi16(cA, _mm256_sub_epi16(full, fA)), _mm256_mullo_epi16(sky16, fA)), 8);
+            cB = _mm256_srli_epi16(_mm256_add_epi16(_mm256_mullo_epi16(cB, _mm256_sub_epi16(full, fB)), _mm256_mullo_epi16(sky16, fB)), 8);
+
+            _mm256_storeu_si256((__m256i*)(color + i), _mm256_packus_epi16(cA, cB));
+        }
+    }
+#endif
+#ifdef SPAN_SSE2
+    {
+        __m128i zero = _mm_setzero_si128();
+        __m128i full = _mm_set1_epi16(256);
+        __m128i sky16 = _mm_unpacklo_epi8(_mm_set1_epi32((int)sky), zero);
+        for (; i + 4 <= count; i += 4) {
+            __m128i c = _mm_loadu_si128((const __m128i*)(color + i));
+
+            __m128i f = _mm_loadu_si128((const __m128i*)(fog + i));
+            __m128i f16 = _mm_packs_epi32(f, f);
+            f16 = _mm_unpacklo_epi16(f16, f16);
+            __m128i fA = _mm_unpacklo_epi32(f16, f16); // fog for spans 0,1
+            __m128i fB = _mm_unpackhi_epi32(f16, f16); // fog for spans 2,3
+
+            __m128i cA = _mm_unpacklo_epi8(c, zero);
+            __m128i cB = _mm_unpackhi_epi8(c, zero);
+            cA = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(cA, _mm_sub_epi16(full, fA)), _mm_mullo_epi16(sky16, fA)), 8);
+            cB = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(cB, _mm_sub_epi16(full, fB)), _mm_mullo_epi16(sky16, fB)), 8);
+
+            _mm_storeu_si128((__m128i*)(color + i), _mm_packus_epi16(cA, cB));
+        }
+    }
+#endif
+
+    // scalar fallback, and any spans left over
+    for (; i < count; i++) {
+        color[i] = shadeOne(color[i], fog[i], sky);
+    }
+}
+
+// Fill the spans of one column, one 32-bit store per pixel
+inline void fillColumn(const SpanBuffer* spans, int first, int end, const RenderTarget* target) {
+    int rowStep = target->rowStep;
+    int depthRowStep = target->depthRowStep;
+
+    for (int i = first; i < end; i++) {
+        int column = spans->column[i];
+        int top = spans->top[i];
+        int rows = spans->bottom[i] - top;
+        uint32_t color = spans->color[i];
+        uint32_t depth = spans->depth[i];
+        uint32_t coord = spans->coord[i];
+
+        if (IsColumnMajor(target)) { // contiguous run
+            uint32_t* px = target->pixels + (column * target->columnStep) + top;
+            uint32_t* dp = target->depths + (column * target->columnStep) + top;
+            uint32_t* cp = target->coords + (column * target->columnStep) + top;
+            for (int k = 0; k <= rows; k++) px[k] = color;
+            for (int k = 0; k <= rows; k++) dp[k] = depth;
+            for (int k = 0; k <= rows; k++) cp[k] = coord;
+            continue;
+        }
+
+        uint32_t* px = target->pixels + (spans->bottom[i] * rowStep) + column;
+        uint32_t* dp = target->depths + (spans->bottom[i] * depthRowStep) + column;
+        uint32_t* cp = target->coords + (spans->bottom[i] * depthRowStep) + column;
+        for (int k = rows; k >= 0; k--) { // bottom to top
+            *px = color;
+            *dp = depth;
+            *cp = coord;
+            px -= rowStep;
+            dp -= depthRowStep;
+            cp -= depthRowStep;
+        }
+    }
+}
+
+#ifdef SPAN_SSE2
+// Tallest column `fillColumnGroup` can hold
+#define FILL_GROUP_ROWS 1024
+
+// Write one column's spans into contiguous scratch columns, four rows per store. Each store may run past the top
+// of its span: the spans above overwrite it, so the spans must cover every row from the first one's bottom up to
+// row zero, with no gaps. Returns false if they don't. Up to three rows before `px` etc. are written.
+inline bool expandColumn(const SpanBuffer* spans, int first, int end, uint32_t* px, uint32_t* dp, uint32_t* cp) {
+    int row = spans->bottom[first];
+    for (int i = first; i < end; i++) {
+        if (spans->bottom[i] != row) return false;
+        int top = spans->top[i];
+        __m128i color = _mm_set1_epi32((int)spans->color[i]);
+        __m128i depth = _mm_set1_epi32((int)spans->depth[i]);
+        __m128i coord = _mm_set1_epi32((int)spans->coord[i]);
+        for (int r = row - 3; ; r -= 4) { // bottom to top
+            _mm_storeu_si128((__m128i*)(px + r), color);
+            _mm_storeu_si128((__m128i*)(dp + r), depth);
+            _mm_storeu_si128((__m128i*)(cp + r), coord);
+            if (r <= top) break;
+        }
+        row = top - 1;
+    }
+    return row == -1;
+}
+
+// Copy rows [0, rows) of four scratch columns to four neighbouring columns of a row-major map, in 4x4 blocks
+inline void transposeGroup(uint32_t* const* columns, uint32_t* dst, int rowStep, int rows) {
+    int y = rows - 4;
+    for (; y >= 0; y -= 4) {
+        __m128i c0 = _mm_loadu_si128((const __m128i*)(columns[0] + y));
+        __m128i c1 = _mm_loadu_si128((const __m128i*)(columns[1] + y));
+        __m128i c2 = _mm_loadu_si128((const __m128i*)(columns[2] + y));
+        __m128i c3 = _mm_loadu_si128((const __m128i*)(columns[3] + y));
+
+        __m128i t0 = _mm_unpacklo_epi32(c0, c1);
+        __m128i t1 = _mm_unpacklo_epi32(c2, c3);
+        __m128i t2 = _mm_unpackhi_epi32(c0, c1);
+        __m128i t3 = _mm_unpackhi_epi32(c2, c3);
+
+        uint32_t* out = dst + (y * rowStep);
+        _mm_storeu_si128((__m128i*)out, _mm_unpacklo_epi64(t0, t1));
+        _mm_storeu_si128((__m128i*)(out + rowStep), _mm_unpackhi_epi64(t0, t1));
+        _mm_storeu_si128((__m128i*)(out + 2 * rowStep), _mm_unpacklo_epi64(t2, t3));
+        _mm_storeu_si128((__m128i*)(out + 3 * rowStep), _mm_unpackhi_epi64(t2, t3));
+    }
+    for (y += 3; y >= 0; y--) { // rows left over at the top
+        uint32_t* out = dst + (y * rowStep);
+        for (int j = 0; j < 4; j++) out[j] = columns[j][y];
+    }
+}
+
+// Fill four neighbouring columns together.
+// Most spans are only a row or two tall, and a whole row apart in a surface, so filling them one column at a time
+// is a short loop and a separate cache line for every pixel. Instead each column is written into contiguous scratch
+// memory a few rows per store, then the four are copied across as rows. Returns false (and writes nothing to the
+// target) unless every column's spans cover all rows from the same bottom row up to zero.
+inline bool fillColumnGroup(const SpanBuffer* spans, const int* first, const RenderTarget* target) {
+    static thread_local uint32_t scratch[3][4][FILL_GROUP_ROWS + 3]; // pixels, depths, coords. 3 rows spare at the top
+    int rows = spans->bottom[first[0]] + 1;
+    if (rows > FILL_GROUP_ROWS) return false;
+
+    uint32_t* columns[3][4];
+    for (int j = 0; j < 4; j++) {
+        for (int m = 0; m < 3; m++) columns[m][j] = scratch[m][j] + 3;
+        if (spans->bottom[first[j]] + 1 != rows) return false;
+        if (!expandColumn(spans, first[j], first[j + 1], columns[0][j], columns[1][j], columns[2][j])) return false;
+    }
+
+    int column = spans->column[first[0]];
+    transposeGroup(columns[0], target->pixels + column, target->rowStep, rows);
+    transposeGroup(columns[1], target->depths + column, target->depthRowStep, rows);
+    transposeGroup(columns[2], target->coords + column, target->depthRowStep, rows);
+    return true;
+}
+#endif
+
+void SpanBufferFill(SpanBuffer* spans, const RenderTarget* target) {
+    int count = spans->count;
+
+    // find where each column's spans start
+    int columnStart[SPAN_BUFFER_SIZE + 1];
+    int columns = 0;
+    for (int i = 0; i < count; i++) {
+        if (i == 0 || spans->column[i] != spans->column[i - 1]) columnStart[columns++] = i;
+    }
+    columnStart[columns] = count;
+
+    int c = 0;
+    while (c < columns) {
+#ifdef SPAN_SSE2
+        // four neighbouring columns?
+        if (c + 4 <= columns && !IsColumnMajor(target)) {
+            int col = spans->column[columnStart[c]];
+            bool group = true;
+            for (int j = 1; j < 4 && group; j++) group = spans->column[columnStart[c + j]] == col + j;
+
+            if (group && fillColumnGroup(spans, columnStart + c, target)) {
+                c += 4;
+                continue;
+            }
+        }
+#endif
+
+        fillColumn(spans, columnStart[c], columnStart[c + 1], target);
+        c++;
+    }
+    spans->count = 0;
+}
+
+void SpanBufferFlush(SpanBuffer* spans, uint32_t sky, const RenderTarget* target) {
+    SpanBufferShade(spans, sky);
+    SpanBufferFill(spans, target);
+}
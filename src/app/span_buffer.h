@@ -0,0 +1,67 @@
+#ifndef SDLBASE_SPAN_BUFFER_H
+#define SDLBASE_SPAN_BUFFER_H
+
+#include <cstdint>
+#include <SDL.h>
+#include "render_target.h"
+
+/*
+    Vertical spans of screen pixels, collected from one or more ray-cast columns.
+
+    Ray marchers append a span for each visible texel (and one for the sky),
+    then the whole buffer is shaded and written out in one go.
+    Colors arrive already lit (see `GenerateLitColor`), so shading is just fog,
+    done several spans at a time with SSE2 or AVX2 when available.
+
+    Colors are packed as one 32-bit word per pixel: 0x00RRGGBB (B,G,R,X in memory),
+    which matches the 32-bit screen surface formats.
+*/
+
+// Number of spans held before a buffer must be flushed. Must be more than the screen height.
+#define SPAN_BUFFER_SIZE 2048
+
+#define PACK_RGB(r,g,b) ((uint32_t)(((r) << 16) | ((g) << 8) | (b)))
+
+typedef struct SpanBuffer {
+    int count;
+
+    // Where the span is drawn. Rows are inclusive, and top <= bottom
+    int16_t column[SPAN_BUFFER_SIZE];
+    int16_t top[SPAN_BUFFER_SIZE];
+    int16_t bottom[SPAN_BUFFER_SIZE];
+
+    // What is drawn
+    uint32_t color[SPAN_BUFFER_SIZE]; // packed color before shading
+    uint32_t fog[SPAN_BUFFER_SIZE]; // fog blend, 0..256. Zero is no fog, 256 is all sky
+    uint32_t depth[SPAN_BUFFER_SIZE]; // value written to the depth map
+    uint32_t coord[SPAN_BUFFER_SIZE]; // value written to the coordinate map (see `PACK_MAP_COORD`)
+} SpanBuffer;
+
+// Room left in the buffer
+inline int SpanBufferSpace(const SpanBuffer* spans) {
+    return SPAN_BUFFER_SIZE - spans->count;
+}
+
+// Add a span. The caller must make sure there is space.
+inline void SpanBufferAdd(SpanBuffer* spans, int column, int top, int bottom,
+                          uint32_t color, uint32_t fog, uint32_t depth, uint32_t coord) {
+    int i = spans->count++;
+    spans->column[i] = (int16_t)column;
+    spans->top[i] = (int16_t)top;
+    spans->bottom[i] = (int16_t)bottom;
+    spans->color[i] = color;
+    spans->fog[i] = fog;
+    spans->depth[i] = depth;
+    spans->coord[i] = coord;
+}
+
+// Apply fog to all span colors, in place. `sky` is the packed fog color
+void SpanBufferShade(SpanBuffer* spans, uint32_t sky);
+
+// Write all spans to the target pixels, depths and map coordinates, then empty the buffer.
+void SpanBufferFill(SpanBuffer* spans, const RenderTarget* target);
+
+// Shade, then fill.
+void SpanBufferFlush(SpanBuffer* spans, uint32_t sky, const RenderTarget* target);
+
+#endif //SDLBASE_SPAN_BUFFER_H
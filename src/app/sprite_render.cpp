@@ -0,0 +1,219 @@
+#include "sprite_render.h"
+#include "job_pool.h"
+#include "span_buffer.h"
+#include "types/MemoryManager.h"
+#include "synth/map_synth.h"
+
+#include <cmath>
+
+#define max(a,b) (((a) > (b)) ? (a) : (b))
+#define min(a,b) (((a) < (b)) ? (a) : (b))
+
+#define FIXED(v) ((int32_t)((v) * 65536.0))
+
+// A sprite after projection: where it lands on the screen, and how to step through its image
+typedef struct ScreenSprite {
+    int left, right; // columns [left, right), clipped to the screen
+    int top, bottom; // rows [top, bottom), clipped to the screen
+    int32_t u0, v0; // image position at the center of pixel (left, top), 16.16
+    int32_t du, dv; // image step for each column and row, 16.16
+    uint32_t hideBelow; // terrain with a depth less than this hides the sprite
+    uint32_t fog; // fog blend. 0 = no fog, 256 = all sky
+    const SpriteImage* image;
+} ScreenSprite;
+
+// Everything the sprite jobs need. Filled once per frame, and read-only while the jobs run
+typedef struct SpriteBatch {
+    const RenderTarget* target;
+    uint32_t sky;
+    int firstColumn, columnStep; // interlacing
+    int bandCount;
+    const ScreenSprite* projected;
+    const int* drawOrder; // indexes into `projected`, far to near
+    int count; // sprites in `drawOrder`
+} SpriteBatch;
+
+static int depthStart[MAX_VIEW_DISTANCE + 1]; // counting sort buckets
+
+// Camera values for projecting sprites, matching `RenderScene` and the ray marchers
+typedef struct SpriteView {
+    NgScenePtr scene;
+    const TileWindow* window;
+    double sinAngle, cosAngle;
+    double halfWidth; // half the screen width, in columns
+    double columnScale; // screen columns for a sideways distance of 1 at a forward distance of 1
+    int width, height;
+    int viewDistance;
+    double fogStart, fogScale;
+} SpriteView;
+
+// Project one sprite. Returns false if it can't be seen
+static bool projectSprite(const Sprite* sprite, const SpriteView* view, ScreenSprite* out) {
+    const SpriteImage* image = sprite->image;
+    if (image == nullptr || image->width < 1 || image->height < 1) return false;
+    NgScenePtr scene = view->scene;
+
+    // ground under the sprite, from the tiles in this frame
+    const TileWindow* window = view->window;
+    int wx = (int)floor(sprite->x) - (window->originX * TILE_SIZE);
+    int wy = (int)floor(sprite->y) - (window->originY * TILE_SIZE);
+    int windowTexels = TILE_WINDOW_SPAN * TILE_SIZE;
+    if (wx < 0 || wx >= windowTexels || wy < 0 || wy >= windowTexels) return false;
+    const MapTile* tile = window->tiles[((wy >> TILE_SHIFT) * TILE_WINDOW_SPAN) + (wx >> TILE_SHIFT)];
+    if (tile == nullptr) return false;
+    uint32_t texel = tile->lit[window->litCopy][TileTexelIndex(wx & TILE_MASK, wy & TILE_MASK, 0)];
+    double foot = SceneTerrainHeight(scene, (int)TEXEL_HEIGHT(texel)) + sprite->lift;
+
+    // distance ahead of the camera, and across the screen
+    double px = sprite->x - scene->camX;
+    double py = sprite->y - scene->camY;
+    double forward = -((view->sinAngle * px) + (view->cosAngle * py));
+    if (forward < 1.0) return false; // behind the camera
+    double distance = sqrt((px * px) + (py * py));
+    if (distance >= view->viewDistance) return false;
+    double across = (view->cosAngle * px) - (view->sinAngle * py);
+
+    // screen rectangle. Rows are projected the same as terrain heights in `rayCast`
+    double center = view->halfWidth + ((across * view->columnScale) / forward);
+    double halfSize = (0.5 * sprite->width * view->columnScale) / forward;
+    double left = center - halfSize, right = center + halfSize;
+    double bottom = ((100.0 * (scene->camHeight - foot)) / forward) - scene->camPitch;
+    double top = ((100.0 * (scene->camHeight - (foot + sprite->height))) / forward) - scene->camPitch;
+    if (right <= 0 || left >= view->width || bottom <= 0 || top >= view->height) return false;
+
+    // whole pixels, at least one each way
+    int x0 = (int)floor(left), x1 = max(x0 + 1, (int)floor(right));
+    int y0 = (int)floor(top), y1 = max(y0 + 1, (int)floor(bottom));
+    double uScale = image->width / max(1.0, right - left);
+    double vScale = image->height / max(1.0, bottom - top);
+    out->du = FIXED(uScale);
+    out->dv = FIXED(vScale);
+    out->u0 = FIXED(((x0 + 0.5) - left) * uScale);
+    out->v0 = FIXED(((y0 + 0.5) - top) * vScale);
+
+    // clip to the screen
+    if (x0 < 0) { out->u0 += out->du * -x0; x0 = 0; }
+    if (y0 < 0) { out->v0 += out->dv * -y0; y0 = 0; }
+    out->left = x0;
+    out->right = min(view->width, x1);
+    out->top = y0;
+    out->bottom = min(view->height, y1);
+
+    auto depth = (uint32_t)max(0.0, distance - 1.0); // the same as the step count in the ray marchers
+    out->hideBelow = (depth > SPRITE_DEPTH_BIAS) ? (depth - SPRITE_DEPTH_BIAS) : 0;
+    out->fog = (scene->doFog && depth > view->fogStart) ? (uint32_t)min(256.0, 256.0 * view->fogScale * (depth - view->fogStart)) : 0;
+    out->image = image;
+    return true;
+}
+
+// blend a packed color toward the sky
+inline uint32_t fogColor(uint32_t color, uint32_t fog, uint32_t sky) {
+    uint32_t keep = 256 - fog;
+    uint32_t r = ((((color >> 16) & 0xFF) * keep) + (((sky >> 16) & 0xFF) * fog)) >> 8;
+    uint32_t g = ((((color >> 8) & 0xFF) * keep) + (((sky >> 8) & 0xFF) * fog)) >> 8;
+    uint32_t b = (((color & 0xFF) * keep) + ((sky & 0xFF) * fog)) >> 8;
+    return (r << 16) | (g << 8) | b;
+}
+
+// Draw one column of a sprite, from the top down to the first nearer terrain pixel
+inline void drawSpriteColumn(const ScreenSprite* sprite, const RenderTarget* target, int x, uint32_t sky) {
+    const SpriteImage* image = sprite->image;
+    int u = min(image->width - 1, (sprite->u0 + ((x - sprite->left) * sprite->du)) >> 16);
+    const uint32_t* texels = image->pixels + u;
+    int lastRow = image->height - 1;
+
+    uint32_t* px = target->pixels + (x * target->columnStep) + (sprite->top * target->rowStep);
+    const uint32_t* dp = target->depths + (x * target->columnStep) + (sprite->top * target->depthRowStep);
+    int32_t v = sprite->v0;
+    for (int y = sprite->top; y < sprite->bottom; y++) {
+        if (*dp < sprite->hideBelow) return; // terrain is nearer, and only gets nearer further down
+
+        uint32_t c = texels[min(lastRow, v >> 16) * image->width];
+        if (c >> 24) *px = (sprite->fog == 0) ? (c & 0x00FFFFFF) : fogColor(c, sprite->fog, sky);
+
+        px += target->rowStep;
+        dp += target->depthRowStep;
+        v += sprite->dv;
+    }
+}
+
+// Draw every sprite that touches one band of screen columns, far to near
+static void drawSpriteBand(void* context, int band) {
+    auto batch = (SpriteBatch*)context;
+    const RenderTarget* target = batch->target;
+    int start = (target->width * band) / batch->bandCount;
+    int end = (target->width * (band + 1)) / batch->bandCount;
+
+    for (int i = 0; i < batch->count; i++) {
+        const ScreenSprite* sprite = &batch->projected[batch->drawOrder[i]];
+        if (sprite->right <= start || sprite->left >= end) continue;
+
+        // first column in the band that's drawn this frame
+        int x = max(start, sprite->left);
+        int offset = (((x - batch->firstColumn) % batch->columnStep) + batch->columnStep) % batch->columnStep;
+        if (offset != 0) x += batch->columnStep - offset;
+
+        int last = min(end, sprite->right);
+        for (; x < last; x += batch->columnStep) {
+            drawSpriteColumn(sprite, target, x, batch->sky);
+        }
+    }
+}
+
+void DrawSprites(NgScenePtr scene, const TileWindow* window, const RenderTarget* target,
+                 const Sprite* sprites, int count, int firstColumn, int columnStep) {
+    if (scene == nullptr || window == nullptr || target == nullptr || sprites == nullptr) return;
+    if (target->depths == nullptr) return;
+    if (count > SPRITE_MAX) count = SPRITE_MAX;
+    if (count < 1) return;
+
+    // working space for this frame only
+    auto projected = (ScreenSprite*) MMFrameAllocate(count * sizeof(ScreenSprite));
+    auto drawOrder = (int*) MMFrameAllocate(count * sizeof(int));
+    if (projected == nullptr || drawOrder == nullptr) return;
+
+    SpriteView view = {};
+    view.scene = scene;
+    view.window = window;
+    view.sinAngle = sin(scene->camAngle);
+    view.cosAngle = cos(scene->camAngle);
+    view.width = target->width;
+    view.height = target->height;
+    view.halfWidth = target->width / 2.0;
+    view.columnScale = (scene->aspect * 1.5) / 2.25; // `y3d` and the column spacing in `RenderScene`
+    view.viewDistance = min(TileCacheViewDistance(), scene->VIEW_DISTANCE); // as far as the terrain is drawn
+    view.fogStart = view.viewDistance * 0.7;
+    view.fogScale = 1 / (view.viewDistance * 0.3);
+
+    // project, and count sprites at each depth
+    for (int d = 0; d <= MAX_VIEW_DISTANCE; d++) depthStart[d] = 0;
+    int visible = 0;
+    for (int i = 0; i < count; i++) {
+        if (!projectSprite(&sprites[i], &view, &projected[visible])) continue;
+        depthStart[projected[visible].hideBelow]++;
+        visible++;
+    }
+    if (visible == 0) return;
+
+    // counting sort, furthest first. Equal depths keep their order
+    int position = 0;
+    for (int d = MAX_VIEW_DISTANCE; d >= 0; d--) {
+        int n = depthStart[d];
+        depthStart[d] = position;
+        position += n;
+    }
+    for (int i = 0; i < visible; i++) {
+        drawOrder[depthStart[projected[i].hideBelow]++] = i;
+    }
+
+    SpriteBatch batch = {};
+    batch.target = target;
+    batch.sky = PACK_RGB(scene->sky_R, scene->sky_G, scene->sky_B);
+    batch.firstColumn = firstColumn;
+    batch.columnStep = max(1, columnStep);
+    batch.projected = projected;
+    batch.drawOrder = drawOrder;
+    batch.count = visible;
+    batch.bandCount = min(target->width, JobPoolThreadCount() * RENDER_BANDS_PER_THREAD);
+    JobPoolRun(drawSpriteBand, &batch, batch.bandCount);
+}
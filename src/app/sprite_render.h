@@ -0,0 +1,50 @@
+#ifndef SDLBASE_SPRITE_RENDER_H
+#define SDLBASE_SPRITE_RENDER_H
+
+#include <cstdint>
+#include "scene.h"
+#include "render_target.h"
+#include "tile_cache.h"
+
+/*
+    Billboard sprites, composited over the terrain after it has been ray cast.
+
+    Each sprite stands on the ground at a map position, and always faces the camera. Sprites are projected
+    the same way the ray marchers project terrain, sorted far to near, and drawn back to front so nearer
+    sprites cover further ones. Terrain hides a sprite wherever the depth map is nearer than the sprite.
+
+    In any screen column, the terrain that's been drawn gets further away going up the screen. So each
+    column of a sprite is drawn from the top down until the first nearer terrain pixel, and everything
+    below that is skipped without being read.
+
+    Sprites don't write depth. Columns are split into bands, drawn across the job pool.
+*/
+
+// Most sprites drawn in one frame. Sprites past this are dropped
+#define SPRITE_MAX 16384
+
+// How much nearer than a sprite (in map texels) terrain must be to hide it. Stops the ground a sprite
+// stands on from cutting off its feet
+#define SPRITE_DEPTH_BIAS 2
+
+// Sprite picture. Pixels are 0xAARRGGBB, row-major from the top. Alpha is either zero (not drawn) or not
+typedef struct SpriteImage {
+    int width, height;
+    const uint32_t* pixels;
+} SpriteImage;
+
+typedef struct Sprite {
+    double x, y; // map position of the sprite's foot
+    float lift; // height of the foot above the ground
+    float width; // in map texels
+    float height; // in the same units as heights and `NgScene::camHeight`. One map texel across is about 3.4 of these up
+    const SpriteImage* image;
+} Sprite;
+
+// Draw sprites over the terrain in `target`, hidden by nearer terrain in its depths. Call after the terrain is drawn.
+// Only columns `firstColumn`, `firstColumn + columnStep`, ... are drawn, to match the terrain when interlacing.
+// Sprites on tiles that aren't in `window` are skipped. Working space comes from the calling thread's frame arena.
+void DrawSprites(NgScenePtr scene, const TileWindow* window, const RenderTarget* target,
+                 const Sprite* sprites, int count, int firstColumn, int columnStep);
+
+#endif //SDLBASE_SPRITE_RENDER_H
@@ -0,0 +1,423 @@
+#include "tile_cache.h"
+#include "tile_synth.h"
+#include "shadow_service.h"
+#include "types/MemoryManager.h"
+#include "synth/map_synth.h"
+
+#include <cmath>
+#include <cstring>
+#include <SDL.h>
+#include <SDL_mutex.h>
+#include <SDL_thread.h>
+
+#define max(a,b) (((a) > (b)) ? (a) : (b))
+#define min(a,b) (((a) < (b)) ? (a) : (b))
+
+static MapTile tiles[TILE_CACHE_SLOTS];
+static int slotCount = 0; // slots allocated by `TileCacheStart`, from the front of `tiles`
+static int cacheViewDistance = MAX_VIEW_DISTANCE; // furthest `slotCount` slots can draw
+static int worldSeed = 0;
+
+static SDL_Thread* loaders[TILE_LOADER_THREADS];
+static TileSynth loaderSynth[TILE_LOADER_THREADS]; // one pipeline for each loader
+static TileSynth foregroundSynth; // for `TileCacheLoadArea`
+static SDL_mutex* cacheLock = nullptr; // guards tile status, coordinates, `lastUsed` and `busy`, and the load queue
+static SDL_sem* loadSignal = nullptr; // posted once for each queued tile
+static SDL_cond* idleSignal = nullptr; // broadcast when the last queued tile finishes
+static volatile bool stopping = false;
+
+// slots waiting for a loader, oldest first
+static int loadQueue[TILE_CACHE_SLOTS];
+static int queueHead = 0;
+static int queueCount = 0;
+static int loading = 0; // queued or being generated
+
+#if TILE_MORTON_ORDER
+uint16_t TileMortonX[TILE_SIZE];
+uint16_t TileMortonY[TILE_SIZE];
+#endif
+
+static uint32_t useStamp = 0; // counts frames and area requests. Tiles not touched by the current one can be evicted
+static bool hasLastCamera = false;
+static double lastCamX = 0, lastCamY = 0;
+
+void TileCopyInterior(const BYTE* padded, BYTE* tileMap, int bytesPerTexel, int firstRow, int endRow) {
+    int rowBytes = TILE_SIZE * bytesPerTexel;
+    int paddedRowBytes = TILE_PADDED * bytesPerTexel;
+    for (int y = firstRow; y < endRow; y++) {
+        memcpy(tileMap + (y * rowBytes), padded + ((y + TILE_APRON) * paddedRowBytes) + (TILE_APRON * bytesPerTexel), rowBytes);
+    }
+}
+
+// the part of the map covered by a tile is within `radius` of a point
+static bool tileInRange(int tileX, int tileY, double x, double y, double radius) {
+    double left = tileX * (double)TILE_SIZE, top = tileY * (double)TILE_SIZE;
+    double dx = (x < left) ? (left - x) : ((x > left + TILE_SIZE) ? (x - left - TILE_SIZE) : 0.0);
+    double dy = (y < top) ? (top - y) : ((y > top + TILE_SIZE) ? (y - top - TILE_SIZE) : 0.0);
+    return (dx * dx) + (dy * dy) <= radius * radius;
+}
+
+static int tileCoord(double v) {
+    return (int)floor(v / TILE_SIZE);
+}
+
+// The slot holding a tile, loaded or not, or null. Cache lock must be held.
+static MapTile* findTile(int tileX, int tileY) {
+    // There are a few hundred slots at most, so a scan is cheaper than keeping a hash index up to date.
+    for (int i = 0; i < slotCount; i++) {
+        MapTile* tile = &tiles[i];
+        if (tile->status != TILE_FREE && tile->tileX == tileX && tile->tileY == tileY) return tile;
+    }
+    return nullptr;
+}
+
+// Claim the least recently used slot for a missing tile and mark it loading.
+// Returns null if every slot is in use this frame. Cache lock must be held.
+static MapTile* claimSlot(int tileX, int tileY) {
+    MapTile* victim = nullptr;
+    for (int i = 0; i < slotCount; i++) {
+        MapTile* tile = &tiles[i];
+        if (tile->status == TILE_LOADING || tile->busy) continue;
+        if (tile->status == TILE_READY && tile->lastUsed >= useStamp) continue; // in use by the current frame or request
+        if (victim == nullptr || (victim->status == TILE_READY && (tile->status == TILE_FREE || tile->lastUsed < victim->lastUsed))) {
+            victim = tile;
+        }
+    }
+    if (victim == nullptr) return nullptr;
+
+    victim->tileX = tileX;
+    victim->tileY = tileY;
+    victim->status = TILE_LOADING;
+    victim->lastUsed = useStamp;
+    return victim;
+}
+
+// Hand a claimed slot to the loader threads. Cache lock must be held.
+static void queueLoad(MapTile* tile) {
+    loadQueue[(queueHead + queueCount) % TILE_CACHE_SLOTS] = (int)(tile - tiles);
+    queueCount++;
+    loading++;
+    SDL_SemPost(loadSignal);
+}
+
+// Touch or queue every tile within `radius` of a point, nearest rings first. Cache lock must be held.
+// If `claimed` is given, missing tiles are listed there for the caller to generate instead of being queued.
+static void requestArea(double x, double y, int radius, TileWindow* window, MapTile** claimed, int* claimedCount) {
+    radius = min(radius, cacheViewDistance); // any further, and the area's own tiles would evict each other
+    int centerX = tileCoord(x), centerY = tileCoord(y);
+    int reach = min(TILE_WINDOW_SPAN / 2, (radius + TILE_SIZE - 1) / TILE_SIZE);
+
+    for (int ring = 0; ring <= reach; ring++) {
+        for (int ty = centerY - ring; ty <= centerY + ring; ty++) {
+            bool edgeRow = (ty == centerY - ring) || (ty == centerY + ring);
+            int step = edgeRow ? 1 : (2 * ring); // only the outline of the ring
+            for (int tx = centerX - ring; tx <= centerX + ring; tx += max(1, step)) {
+                if (!tileInRange(tx, ty, x, y, radius)) continue;
+
+                MapTile* tile = findTile(tx, ty);
+                if (tile == nullptr) {
+                    tile = claimSlot(tx, ty);
+                    if (tile == nullptr) continue; // cache is full
+                    if (claimed != nullptr) claimed[(*claimedCount)++] = tile;
+                    else queueLoad(tile);
+                }
+                tile->lastUsed = useStamp;
+
+                if (window == nullptr || tile->status != TILE_READY) continue;
+                int wx = tx - window->originX, wy = ty - window->originY;
+                if (wx >= 0 && wx < TILE_WINDOW_SPAN && wy >= 0 && wy < TILE_WINDOW_SPAN) {
+                    window->tiles[(wy * TILE_WINDOW_SPAN) + wx] = tile;
+                }
+            }
+        }
+    }
+}
+
+// relight both lit color copies of a tile for `sunAngle`
+static void lightTile(MapTile* tile, BYTE* paddedLight, double sunAngle) {
+    TileLightRows(tile, paddedLight, sunAngle, 0, TILE_PADDED);
+    TileLitRows(tile, paddedLight, 0, 0, TILE_SIZE);
+    TileLitMips(tile, 0);
+    memcpy(tile->lit[1], tile->lit[0], (TILE_SIZE * TILE_SIZE * sizeof(uint32_t)) + MipChainBytes(TILE_SIZE, 4));
+}
+
+// Generate a claimed tile and mark it ready. `queued` tiles came from the load queue
+static void generateTile(MapTile* tile, TileSynth* synth, bool useJobPool, bool queued) {
+    // Light for the newest sun angle. If the sun moves while we work, light again: the shadow service
+    // only relights tiles that were ready when it started.
+    double sunAngle = ShadowServiceLatestAngle();
+    TileSynthRun(synth, tile, worldSeed, sunAngle, useJobPool);
+    while (true) {
+        SDL_LockMutex(cacheLock);
+        double latest = ShadowServiceLatestAngle();
+        if (latest == sunAngle) {
+            tile->status = TILE_READY;
+            if (queued) {
+                loading--;
+                if (loading == 0) SDL_CondBroadcast(idleSignal);
+            }
+            SDL_UnlockMutex(cacheLock);
+            return;
+        }
+        SDL_UnlockMutex(cacheLock);
+
+        sunAngle = latest;
+        lightTile(tile, synth->light, sunAngle);
+    }
+}
+
+static int TileLoader(void* context) {
+    auto synth = (TileSynth*)context;
+    while (true) {
+        SDL_SemWait(loadSignal);
+        if (stopping) break;
+
+        SDL_LockMutex(cacheLock);
+        if (queueCount < 1) {
+            SDL_UnlockMutex(cacheLock);
+            continue;
+        }
+        MapTile* tile = &tiles[loadQueue[queueHead]];
+        queueHead = (queueHead + 1) % TILE_CACHE_SLOTS;
+        queueCount--;
+        SDL_UnlockMutex(cacheLock);
+
+        generateTile(tile, synth, false, true);
+    }
+    return 0;
+}
+
+void TileCacheStart(int seed, int viewDistance) {
+    if (cacheLock != nullptr) return; // already running
+    worldSeed = seed;
+    cacheViewDistance = max(0, min(MAX_VIEW_DISTANCE, viewDistance));
+    slotCount = TILE_SLOTS_FOR(cacheViewDistance);
+
+#if TILE_MORTON_ORDER
+    for (int i = 0; i < TILE_SIZE; i++) {
+        uint32_t bits = 0;
+        for (int b = 0; b < TILE_SHIFT; b++) bits |= ((uint32_t)(i >> b) & 1u) << (2 * b);
+        TileMortonX[i] = (uint16_t)bits;
+        TileMortonY[i] = (uint16_t)(bits << 1);
+    }
+#endif
+
+    int texels = TILE_SIZE * TILE_SIZE;
+    for (int i = 0; i < slotCount; i++) {
+        MapTile* tile = &tiles[i];
+        *tile = {};
+        tile->status = TILE_FREE;
+        // tile maps live as long as the cache, so they go in the large object store rather than filling the state arena
+        tile->paddedHeight = (BYTE*) MMAllocateLarge(TILE_PADDED * TILE_PADDED);
+        tile->height = (BYTE*) MMAllocateLarge(texels + MipChainBytes(TILE_SIZE, 1)); // mips follow the full size map
+        tile->color = (BYTE*) MMAllocateLarge(texels * 3);
+        tile->light = (BYTE*) MMAllocateLarge(texels);
+
+        tile->heightLevels[0] = tile->height;
+        for (int l = 1; l < MAX_LOD_LEVELS; l++) {
+            tile->heightLevels[l] = MipLevel(tile->height + texels, TILE_SIZE, 1, l);
+        }
+        BYTE* peaks = (BYTE*) MMAllocateLarge(MipChainBytes(TILE_SIZE, 1)); // level 1 first, so `peakLevels[1]` is the block
+        tile->peakLevels[0] = tile->height;
+        for (int l = 1; l <= TILE_SHIFT; l++) {
+            tile->peakLevels[l] = MipLevel(peaks, TILE_SIZE, 1, l);
+        }
+        for (int c = 0; c < 2; c++) {
+            tile->lit[c] = (uint32_t*) MMAllocateLarge((texels * sizeof(uint32_t)) + MipChainBytes(TILE_SIZE, 4));
+            tile->litLevels[c][0] = tile->lit[c];
+            for (int l = 1; l < MAX_LOD_LEVELS; l++) {
+                tile->litLevels[c][l] = (uint32_t*)MipLevel((BYTE*)(tile->lit[c] + texels), TILE_SIZE, 4, l);
+            }
+        }
+    }
+
+    queueHead = 0;
+    queueCount = 0;
+    loading = 0;
+    useStamp = 0;
+    hasLastCamera = false;
+    stopping = false;
+
+    cacheLock = SDL_CreateMutex();
+    loadSignal = SDL_CreateSemaphore(0);
+    idleSignal = SDL_CreateCond();
+    TileSynthInit(&foregroundSynth);
+    for (int i = 0; i < TILE_LOADER_THREADS; i++) {
+        TileSynthInit(&loaderSynth[i]);
+        loaders[i] = SDL_CreateThread(TileLoader, "TileLoader", &loaderSynth[i]);
+    }
+}
+
+void TileCacheStop() {
+    if (cacheLock == nullptr) return;
+
+    stopping = true;
+    for (int i = 0; i < TILE_LOADER_THREADS; i++) SDL_SemPost(loadSignal);
+    for (int i = 0; i < TILE_LOADER_THREADS; i++) {
+        SDL_WaitThread(loaders[i], nullptr);
+        loaders[i] = nullptr;
+        TileSynthDispose(&loaderSynth[i]);
+    }
+    TileSynthDispose(&foregroundSynth);
+
+    for (int i = 0; i < slotCount; i++) {
+        MapTile* tile = &tiles[i];
+        MMDrop(tile->paddedHeight);
+        MMDrop(tile->height);
+        MMDrop(tile->color);
+        MMDrop(tile->light);
+        MMDrop(tile->peakLevels[1]);
+        for (int c = 0; c < 2; c++) MMDrop(tile->lit[c]);
+        *tile = {};
+    }
+    slotCount = 0;
+    cacheViewDistance = MAX_VIEW_DISTANCE;
+
+    SDL_DestroyCond(idleSignal);
+    SDL_DestroySemaphore(loadSignal);
+    SDL_DestroyMutex(cacheLock);
+    idleSignal = nullptr;
+    loadSignal = nullptr;
+    cacheLock = nullptr;
+}
+
+void TileCacheBuildWindow(TileWindow* window, double camX, double camY, int viewDistance, int litCopy) {
+    if (window == nullptr) return;
+
+    window->originX = tileCoord(camX) - (TILE_WINDOW_SPAN / 2);
+    window->originY = tileCoord(camY) - (TILE_WINDOW_SPAN / 2);
+    window->litCopy = litCopy;
+    memset(window->tiles, 0, sizeof(window->tiles));
+    if (cacheLock == nullptr) return;
+
+    SDL_LockMutex(cacheLock);
+    useStamp++;
+    requestArea(camX, camY, viewDistance, window, nullptr, nullptr); // before the prefetch, so tiles in view can't be evicted for it
+
+    // prefetch around where the camera is heading
+    if (hasLastCamera) {
+        double aheadX = (camX - lastCamX) * TILE_PREFETCH_FRAMES;
+        double aheadY = (camY - lastCamY) * TILE_PREFETCH_FRAMES;
+        double ahead = sqrt((aheadX * aheadX) + (aheadY * aheadY));
+        if (ahead > TILE_PREFETCH_LIMIT) {
+            aheadX *= TILE_PREFETCH_LIMIT / ahead;
+            aheadY *= TILE_PREFETCH_LIMIT / ahead;
+        }
+        if (ahead >= 1.0) requestArea(camX + aheadX, camY + aheadY, viewDistance, nullptr, nullptr, nullptr);
+    }
+    SDL_UnlockMutex(cacheLock);
+
+    hasLastCamera = true;
+    lastCamX = camX;
+    lastCamY = camY;
+}
+
+int TileCacheViewDistance() {
+    return cacheViewDistance;
+}
+
+void TileCacheRequestArea(double x, double y, int radius) {
+    if (cacheLock == nullptr) return;
+
+    SDL_LockMutex(cacheLock);
+    useStamp++;
+    requestArea(x, y, radius, nullptr, nullptr, nullptr);
+    SDL_UnlockMutex(cacheLock);
+}
+
+void TileCacheLoadArea(double x, double y, int radius) {
+    if (cacheLock == nullptr) return;
+
+    // claim every missing tile, nearest first
+    MapTile* claimed[TILE_CACHE_SLOTS];
+    int count = 0;
+    SDL_LockMutex(cacheLock);
+    useStamp++;
+    requestArea(x, y, radius, nullptr, claimed, &count);
+    SDL_UnlockMutex(cacheLock);
+
+    // one tile at a time, each spread across the job pool
+    for (int i = 0; i < count; i++) {
+        generateTile(claimed[i], &foregroundSynth, true, false);
+    }
+
+    TileCacheWaitIdle(); // any that were already queued
+}
+
+void TileCacheWaitIdle() {
+    if (cacheLock == nullptr) return;
+
+    SDL_LockMutex(cacheLock);
+    while (loading > 0) SDL_CondWait(idleSignal, cacheLock);
+    SDL_UnlockMutex(cacheLock);
+}
+
+MapTile* TileCacheFind(double x, double y) {
+    if (cacheLock == nullptr) return nullptr;
+    int tileX = tileCoord(x), tileY = tileCoord(y);
+
+    MapTile* found = nullptr;
+    SDL_LockMutex(cacheLock);
+    for (int i = 0; i < slotCount; i++) {
+        if (tiles[i].status == TILE_READY && tiles[i].tileX == tileX && tiles[i].tileY == tileY) {
+            found = &tiles[i];
+            break;
+        }
+    }
+    SDL_UnlockMutex(cacheLock);
+    return found;
+}
+
+int TileCacheClaimReady(MapTile** list, int maxTiles) {
+    if (cacheLock == nullptr) return 0;
+
+    int count = 0;
+    SDL_LockMutex(cacheLock);
+    for (int i = 0; i < slotCount && count < maxTiles; i++) {
+        if (tiles[i].status != TILE_READY) continue;
+        tiles[i].busy = true;
+        list[count++] = &tiles[i];
+    }
+    SDL_UnlockMutex(cacheLock);
+    return count;
+}
+
+void TileCacheRelease(MapTile** list, int count) {
+    if (cacheLock == nullptr) return;
+
+    SDL_LockMutex(cacheLock);
+    for (int i = 0; i < count; i++) list[i]->busy = false;
+    SDL_UnlockMutex(cacheLock);
+}
+
+void TileLightRows(const MapTile* tile, BYTE* paddedLight, double sunAngle, int firstRow, int endRow) {
+    GenerateLightRows(TILE_PADDED, tile->paddedHeight, paddedLight, sunAngle, firstRow, endRow);
+}
+
+void TileLitRows(MapTile* tile, const BYTE* paddedLight, int copy, int firstRow, int endRow) {
+    if (firstRow < 0) firstRow = 0;
+    if (endRow > TILE_SIZE) endRow = TILE_SIZE;
+
+    TileCopyInterior(paddedLight, tile->light, 1, firstRow, endRow);
+#if TILE_MORTON_ORDER
+    // one row at a time, then scattered into place
+    uint32_t row[TILE_SIZE];
+    uint32_t* lit = tile->lit[copy];
+    for (int y = firstRow; y < endRow; y++) {
+        int offset = y * TILE_SIZE;
+        GenerateLitColorRows(TILE_SIZE, tile->color + (offset * 3), tile->light + offset, tile->height + offset, row, 0, 1);
+        uint16_t mortonY = TileMortonY[y];
+        for (int x = 0; x < TILE_SIZE; x++) lit[TileMortonX[x] | mortonY] = row[x];
+    }
+#else
+    GenerateLitColorRows(TILE_SIZE, tile->color, tile->light, tile->height, tile->lit[copy], firstRow, endRow);
+#endif
+}
+
+void TileLitMips(MapTile* tile, int copy) {
+#if TILE_MORTON_ORDER
+    GenerateMortonMips(TILE_SIZE, 4, (BYTE*)tile->lit[copy], (BYTE*)tile->litLevels[copy][1]);
+#else
+    GenerateMips(TILE_SIZE, 4, (BYTE*)tile->lit[copy], (BYTE*)tile->litLevels[copy][1]);
+#endif
+}
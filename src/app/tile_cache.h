@@ -0,0 +1,167 @@
+#ifndef SDLBASE_TILE_CACHE_H
+#define SDLBASE_TILE_CACHE_H
+
+#include <cstdint>
+#include "scene.h"
+#include "types/general.h"
+
+/*
+    Streams the world in as square map tiles, so the camera can roam without limit in a fixed amount of memory.
+
+    Tiles are keyed by global tile coordinates (tile (0,0) covers map texels 0..TILE_SIZE-1 on each axis).
+    A fixed set of slots is allocated at start up, enough for the view distance it's given. When a tile is needed and isn't loaded, the least recently
+    drawn slot is reused and the tile is generated by loader threads in the background. Until it's ready,
+    rays that reach it stop, the same as at the edge of the old single map.
+
+    Each tile is generated with a border of extra texels (`TILE_APRON`) so color blur and lighting
+    match across tile edges. Heights come from one global noise field, so tiles line up without seams.
+
+    The lit texels the ray marcher reads are stored in Morton (Z) order by default, so a ray at any angle walks
+    through nearby memory. Map position to texel index goes through `TileTexelIndex`.
+
+    Tile slots are only claimed and evicted by the render thread (`TileCacheBuildWindow`, `TileCacheRequestArea`).
+    A tile is never evicted while it's drawn in the current frame, or while the shadow service is relighting it.
+*/
+
+// Width and height of a tile in map texels. Must be a power of two
+#define TILE_SHIFT 8
+#define TILE_SIZE (1 << TILE_SHIFT)
+#define TILE_MASK (TILE_SIZE - 1)
+
+// Extra texels generated around each tile, so lighting and blur can see across the tile edge.
+// Sun shadows longer than this are cut off at tile edges
+#define TILE_APRON 16
+#define TILE_PADDED (TILE_SIZE + (2 * TILE_APRON))
+
+// The furthest ahead tiles are prefetched, in map texels. Stops a jump of the camera from prefetching a far-off area
+#define TILE_PREFETCH_LIMIT (TILE_SIZE * 4)
+
+// Tile slots (about 1MB each) to draw everything within `distance` of the camera, and prefetch ahead of it.
+// Tiles touching the view circle fit in a circle `TILE_SIZE` wider (pi is 355/113), and the prefetch circle is
+// moved up to `TILE_PREFETCH_LIMIT` from it, which uncovers about its width times that distance
+#define TILE_SLOTS_FOR(distance) ((int)(((355LL * ((distance) + TILE_SIZE) * ((distance) + TILE_SIZE)) / (113LL * TILE_SIZE * TILE_SIZE)) \
+        + ((2LL * ((distance) + TILE_SIZE) * TILE_PREFETCH_LIMIT) / (TILE_SIZE * TILE_SIZE)) + 1))
+
+// Most tile slots the cache can have: enough for `MAX_VIEW_DISTANCE`. Only the slots for the view distance given
+// to `TileCacheStart` are allocated
+#define TILE_CACHE_SLOTS TILE_SLOTS_FOR(MAX_VIEW_DISTANCE)
+
+// Background threads that generate tiles
+#define TILE_LOADER_THREADS 2
+
+// Tiles are prefetched around where the camera will be this many frames from now, at its current speed
+#define TILE_PREFETCH_FRAMES 60
+
+// Tiles across the render window. Wide enough to hold every tile within `MAX_VIEW_DISTANCE` of the camera
+#define TILE_WINDOW_SPAN ((2 * ((MAX_VIEW_DISTANCE + TILE_SIZE - 1) / TILE_SIZE)) + 1)
+
+// seed for the world's height field
+#define TILE_WORLD_SEED 5
+
+// Store lit texels in Morton order (x and y bits interleaved) instead of rows. Set by the USE_MORTON_TILES build option
+#ifndef TILE_MORTON_ORDER
+#define TILE_MORTON_ORDER 1
+#endif
+
+#define TILE_FREE 0
+#define TILE_LOADING 1
+#define TILE_READY 2
+
+typedef struct MapTile {
+    int tileX, tileY; // global tile coordinates
+    int status; // TILE_FREE, TILE_LOADING or TILE_READY. Guarded by the cache lock
+    uint32_t lastUsed; // frame or area request that last drew or asked for this tile. Least recent is evicted first
+    bool busy; // being relit by the shadow service. Can't be evicted
+
+    BYTE* paddedHeight; // TILE_PADDED square, including the apron. Used for lighting
+    BYTE* height; // TILE_SIZE square
+    BYTE* color; // TILE_SIZE square, 3 bytes per texel
+    BYTE* light; // TILE_SIZE square, light level of the last relight
+    // Two copies of the lit texels, swapped by the shadow service. See `ShadowServiceAcquire`.
+    // In the order given by `TileTexelIndex`, unlike the other maps, which are in rows.
+    // Each texel is the lit color and height packed together (see `TEXEL_HEIGHT`), so the ray marcher reads one word.
+    // The mips average each byte, so the height byte of a mip texel matches `heightLevels`.
+    uint32_t* lit[2];
+
+    // start of each level of detail: level 0 is the full tile, then its mips
+    BYTE* heightLevels[MAX_LOD_LEVELS];
+    uint32_t* litLevels[2][MAX_LOD_LEVELS];
+
+    // Highest height in each square block of the tile, in rows. Level `n` has one texel per 2^n block, from
+    // the full size map at level 0 to the whole tile at `TILE_SHIFT`. The ray marcher uses these to skip
+    // blocks that are too low to be seen.
+    BYTE* peakLevels[TILE_SHIFT + 1];
+} MapTile;
+
+// The tiles around the camera for one frame. Read-only while the frame is drawn.
+typedef struct TileWindow {
+    int originX, originY; // global tile coordinates of `tiles[0]`
+    int litCopy; // which of each tile's lit color copies to draw
+    MapTile* tiles[TILE_WINDOW_SPAN * TILE_WINDOW_SPAN]; // row-major, null where a tile isn't ready
+} TileWindow;
+
+#if TILE_MORTON_ORDER
+// Bits of a texel coordinate spread out to even (x) or odd (y) bit positions. Filled by `TileCacheStart`
+extern uint16_t TileMortonX[TILE_SIZE];
+extern uint16_t TileMortonY[TILE_SIZE];
+
+// Index of the lit texel under (x, y) in a tile's map for a level of detail. `x` and `y` are full size texel
+// positions inside the tile. A 2x2 block is 4 texels in a row, so every level is the level above shifted down.
+inline int TileTexelIndex(int x, int y, int level) {
+    return (TileMortonX[x] | TileMortonY[y]) >> (2 * level);
+}
+#else
+inline int TileTexelIndex(int x, int y, int level) {
+    return ((y >> level) << (TILE_SHIFT - level)) + (x >> level);
+}
+#endif
+
+// Allocate tile slots for drawing out to `viewDistance` (no more than `MAX_VIEW_DISTANCE`) and start the loader
+// threads. Call from the main thread before drawing.
+void TileCacheStart(int seed, int viewDistance);
+
+// Furthest the started cache can draw. Every distance and radius given to the cache is clamped to this, and the
+// renderer draws no further. `MAX_VIEW_DISTANCE` if the cache isn't running
+int TileCacheViewDistance();
+
+// Stop and join the loader threads. Tiles being generated are finished first.
+void TileCacheStop();
+
+// Render thread, at the start of each frame: fill `window` with the ready tiles within `viewDistance` of the camera.
+// Missing tiles, and tiles ahead of the camera's movement, are queued for loading.
+void TileCacheBuildWindow(TileWindow* window, double camX, double camY, int viewDistance, int litCopy);
+
+// Render thread, between frames: queue loads for all tiles within `radius` of a map position.
+// Tiles drawn in the last frame and not in this area may be evicted to make room.
+void TileCacheRequestArea(double x, double y, int radius);
+
+// Main thread, with the job pool idle: load all tiles within `radius` of a map position and wait for them.
+// Each missing tile is generated across the whole job pool, so this is faster than queueing them for the loaders.
+void TileCacheLoadArea(double x, double y, int radius);
+
+// Block until every queued tile has loaded
+void TileCacheWaitIdle();
+
+// Render thread: the tile holding a map position, or null if it isn't ready
+MapTile* TileCacheFind(double x, double y);
+
+// Shadow service: mark every ready tile as busy, so none can be evicted, and list them in `tiles`.
+// Returns the number of tiles listed. Call `TileCacheRelease` when done.
+int TileCacheClaimReady(MapTile** tiles, int maxTiles);
+
+// Shadow service: let tiles from `TileCacheClaimReady` be evicted again
+void TileCacheRelease(MapTile** tiles, int count);
+
+// Copy rows [firstRow, endRow) of a tile's own texels out of a padded map (TILE_PADDED square)
+void TileCopyInterior(const BYTE* padded, BYTE* tileMap, int bytesPerTexel, int firstRow, int endRow);
+
+// Redraw rows [firstRow, endRow) of a padded light map for a tile (TILE_PADDED square)
+void TileLightRows(const MapTile* tile, BYTE* paddedLight, double sunAngle, int firstRow, int endRow);
+
+// Copy rows [firstRow, endRow) of a tile's light out of a padded light map, and redraw that tile's lit colors
+void TileLitRows(MapTile* tile, const BYTE* paddedLight, int copy, int firstRow, int endRow);
+
+// Rebuild the lit color mips of one copy, after all its rows are drawn
+void TileLitMips(MapTile* tile, int copy);
+
+#endif //SDLBASE_TILE_CACHE_H
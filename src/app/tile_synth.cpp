@@ -0,0 +1,149 @@
+#include "tile_synth.h"
+#include "job_pool.h"
+#include "types/MemoryManager.h"
+#include "synth/map_synth.h"
+
+#include <cstring>
+
+#define max(a,b) (((a) > (b)) ? (a) : (b))
+#define min(a,b) (((a) < (b)) ? (a) : (b))
+
+// all of `stage` is done for bands b-1 to b+1
+static bool bandsDone(const TileSynth* synth, int stage, int band) {
+    for (int b = max(0, band - 1); b <= min(SYNTH_BANDS - 1, band + 1); b++) {
+        if (synth->task[stage][b] != SYNTH_DONE) return false;
+    }
+    return true;
+}
+
+static bool taskReady(const TileSynth* synth, int stage, int band) {
+    switch (stage) {
+        case SYNTH_HEIGHT: return true;
+        case SYNTH_COLOR: return synth->task[SYNTH_HEIGHT][band] == SYNTH_DONE;
+        case SYNTH_BLUR: return bandsDone(synth, SYNTH_COLOR, band); // one halo row either side
+        case SYNTH_LIGHT: return bandsDone(synth, SYNTH_HEIGHT, band); // slope and occlusion radius
+        case SYNTH_TILE: return synth->task[SYNTH_BLUR][band] == SYNTH_DONE && synth->task[SYNTH_LIGHT][band] == SYNTH_DONE;
+        default: return false;
+    }
+}
+
+// Pick a task that can run now. Later stages first, so finished rows are used while they're still in cache.
+// Lock must be held.
+static bool nextTask(TileSynth* synth, int* stage, int* band) {
+    for (int s = SYNTH_STAGES - 1; s >= 0; s--) {
+        for (int b = 0; b < SYNTH_BANDS; b++) {
+            if (synth->task[s][b] != SYNTH_WAITING || !taskReady(synth, s, b)) continue;
+            *stage = s;
+            *band = b;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void runTask(TileSynth* synth, int stage, int band) {
+    MapTile* tile = synth->tile;
+    int first = band * SYNTH_BAND_ROWS;
+    int end = min(TILE_PADDED, first + SYNTH_BAND_ROWS);
+
+    switch (stage) {
+        case SYNTH_HEIGHT:
+            GenerateHeightAreaRows(TILE_PADDED, synth->seed, (tile->tileX * TILE_SIZE) - TILE_APRON,
+                                   (tile->tileY * TILE_SIZE) - TILE_APRON, tile->paddedHeight, first, end);
+            break;
+        case SYNTH_COLOR:
+            GenerateBaseColorRows(TILE_PADDED, tile->paddedHeight, synth->color, first, end);
+            break;
+        case SYNTH_BLUR:
+            BlurColorRows(TILE_PADDED, synth->color, synth->blurred, first, end);
+            break;
+        case SYNTH_LIGHT:
+            TileLightRows(tile, synth->light, synth->sunAngle, first, end);
+            break;
+        case SYNTH_TILE: { // the tile's own rows of this band
+            int tileFirst = max(0, first - TILE_APRON);
+            int tileEnd = min(TILE_SIZE, end - TILE_APRON);
+            if (tileFirst >= tileEnd) break; // apron only
+            TileCopyInterior(tile->paddedHeight, tile->height, 1, tileFirst, tileEnd);
+            TileCopyInterior(synth->blurred, tile->color, 3, tileFirst, tileEnd);
+            TileLitRows(tile, synth->light, 0, tileFirst, tileEnd);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+// Take and run tasks until the whole tile is done
+static void synthWorker(TileSynth* synth) {
+    SDL_LockMutex(synth->lock);
+    while (synth->remaining > 0) {
+        int stage, band;
+        if (!nextTask(synth, &stage, &band)) { // everything left is waiting on a task another thread is running
+            SDL_CondWait(synth->progress, synth->lock);
+            continue;
+        }
+        synth->task[stage][band] = SYNTH_RUNNING;
+        SDL_UnlockMutex(synth->lock);
+
+        runTask(synth, stage, band);
+
+        SDL_LockMutex(synth->lock);
+        synth->task[stage][band] = SYNTH_DONE;
+        synth->remaining--;
+        SDL_CondBroadcast(synth->progress);
+    }
+    SDL_UnlockMutex(synth->lock);
+}
+
+static void synthJob(void* context, int) {
+    synthWorker((TileSynth*)context);
+}
+
+void TileSynthInit(TileSynth* synth) {
+    if (synth == nullptr) return;
+
+    synth->color = (BYTE*) MMAllocate(TILE_PADDED * TILE_PADDED * 3);
+    synth->blurred = (BYTE*) MMAllocate(TILE_PADDED * TILE_PADDED * 3);
+    synth->light = (BYTE*) MMAllocate(TILE_PADDED * TILE_PADDED);
+    synth->lock = SDL_CreateMutex();
+    synth->progress = SDL_CreateCond();
+}
+
+void TileSynthDispose(TileSynth* synth) {
+    if (synth == nullptr) return;
+
+    SDL_DestroyCond(synth->progress);
+    SDL_DestroyMutex(synth->lock);
+    synth->progress = nullptr;
+    synth->lock = nullptr;
+
+    MMDrop(synth->color);
+    MMDrop(synth->blurred);
+    MMDrop(synth->light);
+    synth->color = nullptr;
+    synth->blurred = nullptr;
+    synth->light = nullptr;
+}
+
+void TileSynthRun(TileSynth* synth, MapTile* tile, int seed, double sunAngle, bool useJobPool) {
+    if (synth == nullptr || tile == nullptr) return;
+
+    synth->tile = tile;
+    synth->seed = seed;
+    synth->sunAngle = sunAngle;
+    memset(synth->task, SYNTH_WAITING, sizeof(synth->task));
+    synth->remaining = SYNTH_STAGES * SYNTH_BANDS;
+
+    if (useJobPool) {
+        JobPoolRun(synthJob, synth, JobPoolThreadCount()); // every thread works through the same task list
+    } else {
+        synthWorker(synth);
+    }
+
+    // whole-tile steps
+    GenerateMips(TILE_SIZE, 1, tile->height, tile->heightLevels[1]);
+    GenerateMaxMips(TILE_SIZE, tile->height, tile->peakLevels[1]);
+    TileLitMips(tile, 0);
+    memcpy(tile->lit[1], tile->lit[0], (TILE_SIZE * TILE_SIZE * sizeof(uint32_t)) + MipChainBytes(TILE_SIZE, 4));
+}
@@ -0,0 +1,68 @@
+#ifndef SDLBASE_TILE_SYNTH_H
+#define SDLBASE_TILE_SYNTH_H
+
+#include <SDL_mutex.h>
+#include "tile_cache.h"
+
+/*
+    Band pipeline that generates all the maps of one tile.
+
+    The padded tile is split into bands of `SYNTH_BAND_ROWS` rows, and each stage runs band by band:
+
+        height -> base color -> blur ----> tile maps (copy out, lit colors)
+           \----------------------> light --^
+
+    A band of a stage can start as soon as the bands it reads are done. Blur and light read into the
+    bands either side (blur needs one halo row, light needs `LIGHT_AO_RADIUS` rows), the other stages
+    only read their own band.
+
+    Any number of threads can work on the same tile, each taking the next task that's ready. A tile
+    can be spread across the job pool (at start up), or made by one loader thread on its own (while
+    streaming). The result is the same either way.
+*/
+
+// Rows in a band. Must be at least the halo any stage reads (`LIGHT_AO_RADIUS`)
+#define SYNTH_BAND_ROWS 32
+#define SYNTH_BANDS ((TILE_PADDED + SYNTH_BAND_ROWS - 1) / SYNTH_BAND_ROWS)
+
+// pipeline stages, in order
+#define SYNTH_HEIGHT 0
+#define SYNTH_COLOR 1
+#define SYNTH_BLUR 2
+#define SYNTH_LIGHT 3
+#define SYNTH_TILE 4
+#define SYNTH_STAGES 5
+
+// task states
+#define SYNTH_WAITING 0
+#define SYNTH_RUNNING 1
+#define SYNTH_DONE 2
+
+typedef struct TileSynth {
+    // working maps, TILE_PADDED square
+    BYTE* color; // before blurring, 3 bytes per texel
+    BYTE* blurred; // 3 bytes per texel
+    BYTE* light;
+
+    SDL_mutex* lock; // guards the task state below
+    SDL_cond* progress; // broadcast when a task finishes
+
+    // the tile being made
+    MapTile* tile;
+    int seed;
+    double sunAngle;
+    BYTE task[SYNTH_STAGES][SYNTH_BANDS]; // SYNTH_WAITING, SYNTH_RUNNING or SYNTH_DONE
+    int remaining; // tasks not done yet
+} TileSynth;
+
+// Allocate working maps and locks. Call from the main thread
+void TileSynthInit(TileSynth* synth);
+
+// Release the working maps and locks from `TileSynthInit`. The synth must be idle
+void TileSynthDispose(TileSynth* synth);
+
+// Generate every map of `tile` for its tile coordinates, with both lit color copies lit for `sunAngle`.
+// With `useJobPool`, bands are spread across the job pool. Otherwise the calling thread does all the work.
+void TileSynthRun(TileSynth* synth, MapTile* tile, int seed, double sunAngle, bool useJobPool);
+
+#endif //SDLBASE_TILE_SYNTH_H
@@ -0,0 +1,439 @@
+#include <SDL.h>
+
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <app/app_start.h>
+#include <app/job_pool.h>
+#include <app/scene_snapshot.h>
+#include <app/tile_cache.h>
+#include <synth/map_synth.h>
+#include <types/MemoryManager.h>
+#include "bench_stats.h"
+#include "render_bench.h"
+
+using namespace std;
+
+// Headless benchmark. Times map synthesis and tile loading, then renders scripted camera paths
+// into an off-screen surface and prints frame time statistics, and compares the render targets.
+// No window or video driver is needed.
+//
+// usage: SdlBench [frames per path] [synthesis runs]
+
+// Frames rendered for each camera path, if not given on the command line
+#define BENCH_PATH_FRAMES 200
+// Camera directions in the facing sweep, evenly spaced around the full circle
+#define BENCH_FACING_STEPS 16
+// Number of times each map synthesis step is run, if not given on the command line
+#define BENCH_SYNTH_RUNS 10
+// Width and height of the map used to time each synthesis step
+#define BENCH_SYNTH_SIZE 512
+// Size of the arena used to time allocation, and allocations made in each run
+#define BENCH_ARENA_SIZE (256 MEGABYTES)
+#define BENCH_ARENA_ALLOCATIONS 10000
+// Zone size for the arena timings with big zones: a tile's maps, or a screen buffer, fit in one
+#define BENCH_BIG_ZONE_SIZE (4 MEGABYTES)
+// Large objects live at once in each run. The sizes step from just over a zone to about 1MB
+#define BENCH_LARGE_OBJECTS 512
+
+// A camera start point and a fixed set of movement keys held down for the whole path
+typedef struct CameraPath {
+    const char* name;
+    double camX, camY, camHeight, camAngle, camPitch;
+    int moveForward, moveStrafeLeft, moveTurnLeft, moveUp, moveLookUp;
+} CameraPath;
+
+static const CameraPath cameraPaths[] = {
+        // name,          x,   y,   height, angle, pitch,   fwd, strafe, turn, up, look
+        {"fly forward",   256, 256, 400,    3.14,  0.0,     1,   0,      0,    0,  0},
+        {"turn in place", 256, 256, 400,    0.0,   0.0,     0,   0,      1,    0,  0},
+        {"low strafe",    100, 400, 250,    1.57,  40.0,    0,   1,      0,    0,  0},
+        {"climb forward", 400, 100, 250,    4.7,   0.0,     1,   0,      0,    1,  0},
+};
+
+// Each path without and then with empty space skipping. High up, most ray steps land on terrain too low to be
+// seen. Low down, most are visible, and tries to skip are wasted
+static const CameraPath skipPaths[] = {
+        {"high, no skipping", 256, 256, 1200, 3.14, 0.0,   1,   0,      0,    0,  0},
+        {"high, skipping",    256, 256, 1200, 3.14, 0.0,   1,   0,      0,    0,  0},
+        {"low, no skipping",  100, 400, 250,  1.57, 40.0,  0,   1,      0,    0,  0},
+        {"low, skipping",     100, 400, 250,  1.57, 40.0,  0,   1,      0,    0,  0},
+};
+
+// Flying forward with each ray marcher: double precision, then fixed point. Both read full size maps only
+static const CameraPath marcherPaths[] = {
+        {"double precision", 256, 256, 400, 3.14, 0.0,    1,   0,      0,    0,  0},
+        {"fixed point",      256, 256, 400, 3.14, 0.0,    1,   0,      0,    0,  0},
+};
+
+// Two outputs that match had (almost certainly) the same pixels
+static uint32_t frameChecksum(SDL_Surface* surface) {
+    uint32_t hash = 2166136261u; // FNV-1a
+    for (int y = 0; y < surface->h; y++) {
+        auto row = (const BYTE*)surface->pixels + (y * surface->pitch);
+        for (int x = 0; x < surface->w * 4; x++) {
+            hash = (hash ^ row[x]) * 16777619u;
+        }
+    }
+    return hash;
+}
+
+static void benchCameraPath(volatile ApplicationGlobalState* state, SDL_Surface* surface, const CameraPath* path, int frames, BenchSamples* samples) {
+    auto scene = state->scene;
+    scene->camX = path->camX;
+    scene->camY = path->camY;
+    scene->camHeight = path->camHeight;
+    scene->camAngle = path->camAngle;
+    scene->camPitch = path->camPitch;
+    scene->moveForward = path->moveForward;
+    scene->moveStrafeLeft = path->moveStrafeLeft;
+    scene->moveTurnLeft = path->moveTurnLeft;
+    scene->moveUp = path->moveUp;
+    scene->moveLookUp = path->moveLookUp;
+    scene->sceneTime = 0.0;
+    SceneSnapshotPublish(state->sceneSnapshots, scene);
+
+    MMFrameReset();
+    RenderFrame(state, surface); // warm up
+
+    BenchReset(samples, path->name);
+    for (int i = 0; i < frames; i++) {
+        MMFrameReset(); // frame boundary, as in the main loop
+        UpdateModel(state, (uint32_t)i, FRAME_TIME_TARGET); // fixed time step, so every run sees the same frames
+
+        // every tile in view is loaded before the frame, so every run draws the same pixels. Tile loading is timed separately
+        TileCacheRequestArea(scene->camX, scene->camY, scene->VIEW_DISTANCE);
+        TileCacheWaitIdle();
+
+        uint64_t st = BenchNow();
+        RenderFrame(state, surface); // through the scene snapshot, as the render thread does
+        BenchAddSince(samples, st);
+    }
+    BenchPrint(samples);
+    cout << ", last frame " << hex << frameChecksum(surface) << dec;
+}
+
+// Render from one spot, facing each way in turn. With tile maps in Morton order, the times should all be close.
+static void benchFacingSweep(volatile ApplicationGlobalState* state, SDL_Surface* surface, int frames, BenchSamples* samples) {
+    static char labels[BENCH_FACING_STEPS][32];
+    auto scene = state->scene;
+    double fastest = 0, slowest = 0;
+
+    for (int step = 0; step < BENCH_FACING_STEPS; step++) {
+        double degrees = (360.0 * step) / BENCH_FACING_STEPS;
+        scene->camX = 256;
+        scene->camY = 256;
+        scene->camHeight = 400;
+        scene->camAngle = degrees * (3.14159265358979 / 180.0);
+        scene->camPitch = 0;
+        scene->moveForward = scene->moveStrafeLeft = scene->moveTurnLeft = scene->moveUp = scene->moveLookUp = 0;
+        SceneSnapshotPublish(state->sceneSnapshots, scene);
+
+        TileCacheRequestArea(scene->camX, scene->camY, scene->VIEW_DISTANCE);
+        TileCacheWaitIdle();
+        MMFrameReset();
+        RenderFrame(state, surface); // warm up
+
+        snprintf(labels[step], sizeof(labels[step]), "facing %5.1f deg", degrees);
+        BenchReset(samples, labels[step]);
+        for (int i = 0; i < frames; i++) {
+            MMFrameReset();
+            uint64_t st = BenchNow();
+            RenderFrame(state, surface);
+            BenchAddSince(samples, st);
+        }
+        BenchPrint(samples); // sorts, so the median is in the middle
+
+        double median = samples->ms[samples->count / 2];
+        if (step == 0 || median < fastest) fastest = median;
+        if (step == 0 || median > slowest) slowest = median;
+    }
+    cout << "\r\n  slowest facing / fastest facing (medians): " << (slowest / fastest);
+}
+
+static void benchSynthesis(int runs, BenchSamples* samples) {
+    int size = BENCH_SYNTH_SIZE;
+    auto heightMap = (BYTE *) MMAllocate(size * size);
+    auto colorMap = (BYTE *) MMAllocate(size * size * 3);
+    auto lightMap = (BYTE *) MMAllocate(size * size);
+    auto litMap = (uint32_t *) MMAllocate(size * size * sizeof(uint32_t));
+    auto heightMips = (BYTE *) MMAllocate(MipChainBytes(size, 1));
+    auto litMips = (uint32_t *) MMAllocate(MipChainBytes(size, 4));
+
+    BenchReset(samples, "GenerateHeight");
+    for (int i = 0; i < runs; i++) {
+        uint64_t st = BenchNow();
+        GenerateHeight(size, 5, heightMap);
+        BenchAddSince(samples, st);
+    }
+    BenchPrint(samples);
+
+    BenchReset(samples, "GenerateColor");
+    for (int i = 0; i < runs; i++) {
+        uint64_t st = BenchNow();
+        GenerateColor(size, heightMap, colorMap);
+        BenchAddSince(samples, st);
+    }
+    BenchPrint(samples);
+
+    // the color blur on its own, old kernel against the separable one
+    auto blurred = (BYTE *) MMAllocate(size * size * 3);
+    BenchReset(samples, "Blur, 3x3 kernel (old)");
+    for (int i = 0; i < runs; i++) {
+        memcpy(blurred, colorMap, (size_t)(size * size * 3));
+        uint64_t st = BenchNow();
+        BlurColorReference(size, blurred);
+        BenchAddSince(samples, st);
+    }
+    BenchPrint(samples);
+
+    BenchReset(samples, "Blur, separable");
+    for (int i = 0; i < runs; i++) {
+        uint64_t st = BenchNow();
+        BlurColorRows(size, colorMap, blurred, 0, size);
+        BenchAddSince(samples, st);
+    }
+    BenchPrint(samples);
+
+    BenchReset(samples, "GenerateLight");
+    for (int i = 0; i < runs; i++) {
+        uint64_t st = BenchNow();
+        GenerateLight(size, heightMap, lightMap, 10.0 + (160.0 * i / runs)); // sweep the sun across the sky
+        BenchAddSince(samples, st);
+    }
+    BenchPrint(samples);
+
+    BenchReset(samples, "GenerateLitColor");
+    for (int i = 0; i < runs; i++) {
+        uint64_t st = BenchNow();
+        GenerateLitColor(size, colorMap, lightMap, heightMap, litMap);
+        BenchAddSince(samples, st);
+    }
+    BenchPrint(samples);
+
+    BenchReset(samples, "GenerateMips (all maps)");
+    for (int i = 0; i < runs; i++) {
+        uint64_t st = BenchNow();
+        GenerateMips(size, 1, heightMap, heightMips);
+        GenerateMips(size, 4, (BYTE*)litMap, (BYTE*)litMips);
+        BenchAddSince(samples, st);
+    }
+    BenchPrint(samples);
+}
+
+// Time loading 3x3 blocks of new tiles, on the loader threads and across the job pool, from request to ready
+static void benchTileLoads(int runs, BenchSamples* samples) {
+    BenchReset(samples, "Load 3x3 tiles (loaders)");
+    for (int i = 0; i < runs; i++) {
+        double x = (1000.5 + (4 * i)) * TILE_SIZE; // far from the camera paths, and never loaded before
+        double y = 1000.5 * TILE_SIZE;
+        uint64_t st = BenchNow();
+        TileCacheRequestArea(x, y, TILE_SIZE);
+        TileCacheWaitIdle();
+        BenchAddSince(samples, st);
+    }
+    BenchPrint(samples);
+
+    BenchReset(samples, "Load 3x3 tiles (job pool)");
+    for (int i = 0; i < runs; i++) {
+        double x = (1000.5 + (4 * i)) * TILE_SIZE;
+        double y = 1004.5 * TILE_SIZE;
+        uint64_t st = BenchNow();
+        TileCacheLoadArea(x, y, TILE_SIZE);
+        BenchAddSince(samples, st);
+    }
+    BenchPrint(samples);
+}
+
+// Time allocations in an arena where every zone is nearly full, apart from the first and last.
+// Each pair of allocations only fits in those two, so finding the second one's zone is the whole cost
+static void benchArena(int runs, BenchSamples* samples) {
+    Arena* arena = NewArena(BENCH_ARENA_SIZE);
+    if (arena == nullptr) return;
+    int zones = 0;
+    ArenaGetState(arena, nullptr, nullptr, nullptr, &zones, nullptr, nullptr);
+    void* first = nullptr;
+    void* last = nullptr;
+    for (int i = 0; i < zones; i++) {
+        last = ArenaAllocate(arena, ARENA_ZONE_SIZE - 32);
+        if (i == 0) first = last;
+    }
+    ArenaDereference(arena, first);
+    ArenaDereference(arena, last);
+
+    BenchReset(samples, "Nearly full arena");
+    for (int i = 0; i < runs; i++) {
+        uint64_t st = BenchNow();
+        for (int j = 0; j < BENCH_ARENA_ALLOCATIONS / 2; j++) {
+            void* a = ArenaAllocate(arena, ARENA_ZONE_SIZE / 2);
+            void* b = ArenaAllocate(arena, ARENA_ZONE_SIZE / 2);
+            ArenaDereference(arena, a);
+            ArenaDereference(arena, b);
+        }
+        BenchAddSince(samples, st);
+    }
+    BenchPrint(samples);
+    DropArena(&arena);
+}
+
+// Time allocating small objects (16 to 256 bytes) until there are `BENCH_ARENA_ALLOCATIONS`, then dereferencing
+// them all, in an arena with the given zone size
+static void benchArenaSmallObjects(int runs, BenchSamples* samples, size_t zoneSize, const char* label) {
+    static void* objects[BENCH_ARENA_ALLOCATIONS];
+    Arena* arena = NewArenaWithZoneSize(BENCH_ARENA_SIZE, zoneSize);
+    if (arena == nullptr) return;
+
+    BenchReset(samples, label);
+    for (int i = 0; i < runs; i++) {
+        uint64_t st = BenchNow();
+        for (int j = 0; j < BENCH_ARENA_ALLOCATIONS; j++) {
+            objects[j] = ArenaAllocate(arena, 16 + ((j * 37) % 241));
+        }
+        for (int j = 0; j < BENCH_ARENA_ALLOCATIONS; j++) {
+            ArenaDereference(arena, objects[j]);
+        }
+        BenchAddSince(samples, st);
+    }
+    BenchPrint(samples);
+    DropArena(&arena);
+}
+
+// Time filling an arena with objects as big as its zones, then dereferencing them all
+static void benchArenaZoneObjects(int runs, BenchSamples* samples) {
+    static void* objects[BENCH_ARENA_SIZE / BENCH_BIG_ZONE_SIZE];
+    Arena* arena = NewArenaWithZoneSize(BENCH_ARENA_SIZE, BENCH_BIG_ZONE_SIZE);
+    if (arena == nullptr) return;
+    int count = BENCH_ARENA_SIZE / BENCH_BIG_ZONE_SIZE;
+
+    BenchReset(samples, "4MB objects, 4MB zones");
+    for (int i = 0; i < runs; i++) {
+        uint64_t st = BenchNow();
+        for (int j = 0; j < count; j++) {
+            objects[j] = ArenaAllocate(arena, BENCH_BIG_ZONE_SIZE);
+        }
+        for (int j = 0; j < count; j++) {
+            ArenaDereference(arena, objects[j]);
+        }
+        BenchAddSince(samples, st);
+    }
+    BenchPrint(samples);
+    DropArena(&arena);
+}
+
+// Time allocating a set of large objects, then dropping them in a scattered order. The store's blocks
+// are reused from the second run on, so the first is slowest
+static void benchLargeObjects(int runs, BenchSamples* samples) {
+    static void* blocks[BENCH_LARGE_OBJECTS];
+
+    BenchReset(samples, "Allocate and drop");
+    for (int i = 0; i < runs; i++) {
+        uint64_t st = BenchNow();
+        for (int j = 0; j < BENCH_LARGE_OBJECTS; j++) {
+            blocks[j] = MMAllocate(ARENA_ZONE_SIZE + 1 + ((j * 7919) % (1 MEGABYTE)));
+        }
+        for (int j = 0; j < BENCH_LARGE_OBJECTS; j++) {
+            MMDrop(blocks[(j * 97) % BENCH_LARGE_OBJECTS]); // 97 is coprime to the count, so each is dropped once
+        }
+        BenchAddSince(samples, st);
+    }
+    BenchPrint(samples);
+}
+
+// User/Core shared data:
+volatile ApplicationGlobalState gState = {};
+
+// Too big for the stack
+BenchSamples samples;
+
+// We undefine the `main` macro in SDL_main.h, because it confuses the linker.
+#undef main
+
+int main(int argc, char** argv)
+{
+    int frames = argc > 1 ? atoi(argv[1]) : BENCH_PATH_FRAMES;
+    int runs = argc > 2 ? atoi(argv[2]) : BENCH_SYNTH_RUNS;
+    if (frames < 1) frames = 1;
+    if (runs < 1) runs = 1;
+
+    if (SDL_Init(SDL_INIT_TIMER) < 0) { // no video
+        cout << "SDL initialization failed. SDL Error: " << SDL_GetError();
+        return 1;
+    }
+
+    // Same pixel layout as the window surface in the app
+    SDL_Surface* surface = SDL_CreateRGBSurface(0, SCREEN_WIDTH, SCREEN_HEIGHT, 32, 0x00FF0000, 0x0000FF00, 0x000000FF, 0);
+    if (surface == nullptr) {
+        cout << "Surface could not be created! SDL_Error: " << SDL_GetError();
+        return 1;
+    }
+
+    uint64_t st = BenchNow();
+    StartUp(&gState);
+    BenchReset(&samples, "StartUp");
+    BenchAddSince(&samples, st);
+    BenchPrint(&samples);
+
+    gState.scene->doInterlacing = false; // draw every column, every frame
+    gState.scene->adaptiveResolution = false; // and always the whole screen width, so runs can be compared
+    SceneSnapshotPublish(gState.sceneSnapshots, gState.scene);
+
+    cout << "\r\n\r\nMap synthesis, " << BENCH_SYNTH_SIZE << "x" << BENCH_SYNTH_SIZE << ":";
+    benchSynthesis(runs, &samples);
+
+    cout << "\r\n\r\nTile cache, " << TILE_SIZE << "x" << TILE_SIZE << " tiles, " << TILE_LOADER_THREADS << " loader threads:";
+    benchTileLoads(runs, &samples);
+
+    cout << "\r\n\r\nArena, " << (BENCH_ARENA_SIZE / ARENA_ZONE_SIZE) << " zones, " << BENCH_ARENA_ALLOCATIONS << " allocations per run:";
+    benchArena(runs, &samples);
+    benchArenaSmallObjects(runs, &samples, ARENA_ZONE_SIZE, "Small objects, 64K zones");
+    benchArenaSmallObjects(runs, &samples, BENCH_BIG_ZONE_SIZE, "Small objects, 4MB zones");
+    benchArenaZoneObjects(runs, &samples);
+
+    cout << "\r\n\r\nLarge objects, " << BENCH_LARGE_OBJECTS << " per run:";
+    benchLargeObjects(runs, &samples);
+
+    cout << "\r\n\r\nFacing sweep, " << (TILE_MORTON_ORDER ? "Morton" : "row") << " order tile maps:";
+    benchFacingSweep(&gState, surface, frames, &samples);
+
+    cout << "\r\n\r\nRenderScene, " << SCREEN_WIDTH << "x" << SCREEN_HEIGHT << ", " << JobPoolThreadCount() << " threads:";
+    for (auto& path : cameraPaths) {
+        benchCameraPath(&gState, surface, &path, frames, &samples);
+    }
+
+    cout << "\r\n\r\nRay marchers, no levels of detail (pixels match to within rounding):";
+    bool fixedDefault = gState.scene->fixedPointMarch, lodDefault = gState.scene->lodMarching;
+    gState.scene->lodMarching = false;
+    for (int i = 0; i < (int)(sizeof(marcherPaths) / sizeof(marcherPaths[0])); i++) {
+        gState.scene->fixedPointMarch = (i & 1) != 0;
+        benchCameraPath(&gState, surface, &marcherPaths[i], frames, &samples);
+    }
+    gState.scene->fixedPointMarch = fixedDefault;
+    gState.scene->lodMarching = lodDefault;
+
+    cout << "\r\n\r\nEmpty space skipping (checksums should match):";
+    bool skipDefault = gState.scene->skipEmptySpace;
+    for (int i = 0; i < (int)(sizeof(skipPaths) / sizeof(skipPaths[0])); i++) {
+        gState.scene->skipEmptySpace = (i & 1) != 0;
+        benchCameraPath(&gState, surface, &skipPaths[i], frames, &samples);
+    }
+    gState.scene->skipEmptySpace = skipDefault;
+
+    cout << "\r\n";
+    BenchmarkRenderTargets(&gState, gState.scene, surface, frames);
+
+    size_t scratchPeak = 0, scratchSize = 0;
+    int scratchFailures = 0;
+    MMFrameState(&scratchPeak, &scratchSize, &scratchFailures);
+    cout << "\r\n\r\nFrame scratch: peak " << (scratchPeak / 1024) << "KB of " << (scratchSize / 1024) << "KB, "
+         << scratchFailures << " allocations didn't fit";
+    cout << "\r\nDrops not found: " << MMDropFailures();
+    cout << "\r\n";
+
+    Shutdown(&gState);
+    SDL_FreeSurface(surface);
+    SDL_Quit();
+    return 0;
+}
+
+#pragma comment(linker, "/subsystem:Console")
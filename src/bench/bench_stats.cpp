@@ -0,0 +1,45 @@
+#include "bench_stats.h"
+
+#include <SDL.h>
+#include <algorithm>
+#include <iostream>
+
+using namespace std;
+
+void BenchReset(BenchSamples* samples, const char* label) {
+    samples->label = label;
+    samples->count = 0;
+}
+
+uint64_t BenchNow() {
+    return SDL_GetPerformanceCounter();
+}
+
+void BenchAddSince(BenchSamples* samples, uint64_t start) {
+    uint64_t ticks = SDL_GetPerformanceCounter() - start;
+    if (samples->count >= BENCH_MAX_SAMPLES) return;
+    samples->ms[samples->count++] = 1000.0 * (double)ticks / (double)SDL_GetPerformanceFrequency();
+}
+
+// value at `fraction` (0..1) through sorted samples, nearest rank
+static double percentile(const BenchSamples* samples, double fraction) {
+    int rank = (int)(fraction * (double)samples->count + 0.999999) - 1;
+    if (rank < 0) rank = 0;
+    if (rank >= samples->count) rank = samples->count - 1;
+    return samples->ms[rank];
+}
+
+void BenchPrint(BenchSamples* samples) {
+    cout << "\r\n  " << samples->label << ": ";
+    if (samples->count < 1) {
+        cout << "no samples";
+        return;
+    }
+
+    sort(samples->ms, samples->ms + samples->count);
+    cout << samples->count << " runs, "
+         << "min " << samples->ms[0] << "ms, "
+         << "median " << percentile(samples, 0.5) << "ms, "
+         << "p99 " << percentile(samples, 0.99) << "ms, "
+         << "max " << samples->ms[samples->count - 1] << "ms";
+}
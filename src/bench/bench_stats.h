@@ -0,0 +1,28 @@
+#ifndef SDLBASE_BENCH_STATS_H
+#define SDLBASE_BENCH_STATS_H
+
+#include <cstdint>
+
+// Most timings that can be held by one set of samples
+#define BENCH_MAX_SAMPLES 4096
+
+// A set of timings, in milliseconds
+typedef struct BenchSamples {
+    const char* label;
+    int count;
+    double ms[BENCH_MAX_SAMPLES];
+} BenchSamples;
+
+// Start a new set of timings
+void BenchReset(BenchSamples* samples, const char* label);
+
+// Read the high resolution timer, for use with `BenchAddSince`
+uint64_t BenchNow();
+
+// Record the time since `start` (from `BenchNow`). Samples past the limit are dropped.
+void BenchAddSince(BenchSamples* samples, uint64_t start);
+
+// Print count, min, median, 99th percentile and max of a set of timings. Sorts the samples.
+void BenchPrint(BenchSamples* samples);
+
+#endif //SDLBASE_BENCH_STATS_H
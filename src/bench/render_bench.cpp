@@ -0,0 +1,119 @@
+#include "render_bench.h"
+#include <app/app_start.h>
+#include <app/scene.h>
+#include <app/job_pool.h>
+#include <types/MemoryManager.h>
+
+#include <iostream>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cstring>
+#endif
+
+using namespace std;
+
+// Open a hardware cache-miss counter for the calling thread. Returns -1 if not available
+static int OpenCacheMissCounter() {
+#ifdef __linux__
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+    return -1;
+#endif
+}
+
+static void StartCounter(int counter) {
+#ifdef __linux__
+    if (counter < 0) return;
+    ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+    ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+}
+
+static int64_t StopCounter(int counter) {
+#ifdef __linux__
+    if (counter < 0) return -1;
+    ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+    int64_t count = 0;
+    if (read(counter, &count, sizeof(count)) != sizeof(count)) return -1;
+    return count;
+#else
+    return -1;
+#endif
+}
+
+static void CloseCounter(int counter) {
+#ifdef __linux__
+    if (counter >= 0) close(counter);
+#endif
+}
+
+// Render a run of frames, print the average and best frame times, and cache misses if counted
+static void RunTargetBench(volatile ApplicationGlobalState *state, NgScenePtr scene, SDL_Surface *screen, int frames, bool columnMajor, int counter, const char* label) {
+    scene->columnMajorTarget = columnMajor;
+    MMFrameReset();
+    RenderScene(state, scene, screen); // warm up
+
+    uint64_t freq = SDL_GetPerformanceFrequency();
+    uint64_t total = 0;
+    uint64_t best = UINT64_MAX;
+
+    StartCounter(counter);
+    for (int i = 0; i < frames; i++) {
+        MMFrameReset(); // each frame's scratch memory, as in the main loop
+        uint64_t st = SDL_GetPerformanceCounter();
+        RenderScene(state, scene, screen);
+        uint64_t t = SDL_GetPerformanceCounter() - st;
+        total += t;
+        if (t < best) best = t;
+    }
+    int64_t misses = StopCounter(counter);
+
+    cout << "\r\n  " << label << (columnMajor ? "column target:  " : "surface target: ")
+         << "ave " << (1000.0 * (double)total / (double)frames / (double)freq) << "ms, "
+         << "best " << (1000.0 * (double)best / (double)freq) << "ms";
+    if (counter >= 0) {
+        if (misses >= 0) cout << ", cache misses/frame " << (misses / frames);
+        else cout << ", cache misses n/a";
+    }
+}
+
+void BenchmarkRenderTargets(volatile ApplicationGlobalState *state, NgScenePtr scene, SDL_Surface *screen, int frames) {
+    if (state == nullptr || scene == nullptr || screen == nullptr) return;
+    if (frames < 1) frames = 1;
+
+    bool oldColumnMajor = scene->columnMajorTarget;
+    bool oldInterlace = scene->doInterlacing;
+    int oldWidth = state->renderWidth;
+    scene->doInterlacing = false; // every column, every frame
+    state->renderWidth = 0;
+
+    cout << "\r\nRender target benchmark, " << frames << " frames at " << screen->w << "x" << screen->h
+         << ", " << JobPoolThreadCount() << " threads:";
+    RunTargetBench(state, scene, screen, frames, false, -1, "");
+    RunTargetBench(state, scene, screen, frames, true, -1, "");
+
+    // single thread, so the counter sees all the work
+    JobPoolStop();
+    int counter = OpenCacheMissCounter();
+    if (counter < 0) cout << "\r\n(hardware cache counters not available)";
+    RunTargetBench(state, scene, screen, frames, false, counter, "1 thread, ");
+    RunTargetBench(state, scene, screen, frames, true, counter, "1 thread, ");
+    CloseCounter(counter);
+    JobPoolStart(RENDER_THREADS);
+
+    scene->columnMajorTarget = oldColumnMajor;
+    scene->doInterlacing = oldInterlace;
+    state->renderWidth = oldWidth;
+}
@@ -0,0 +1,13 @@
+#ifndef SDLBASE_RENDER_BENCH_H
+#define SDLBASE_RENDER_BENCH_H
+
+#include <SDL.h>
+#include <app/shared_types.h>
+
+// Render `frames` frames of `scene`, drawing straight to the surface and then through the
+// column-major target, and print frame times for each. The render pool is then stopped for a single-threaded
+// pass, where hardware cache misses are also counted (Linux only, needs perf events to be allowed).
+// Scene settings are restored afterwards. The calling thread's frame arena is reset for every frame.
+void BenchmarkRenderTargets(volatile ApplicationGlobalState *state, NgScenePtr scene, SDL_Surface *screen, int frames);
+
+#endif //SDLBASE_RENDER_BENCH_H
@@ -4,6 +4,7 @@
 
 #include <iostream>
 #include <app/app_start.h>
+#include <types/MemoryManager.h>
 
 using namespace std;
 
@@ -13,11 +14,13 @@ SDL_Window* window; //The window we'll be rendering to
 SDL_Surface* screenSurface;// The surface contained by the window
 
 volatile bool quit = false; // Quit flag
-volatile bool drawDone = false; // Quit complete flag
-volatile int frameWait = 0; // frames waiting
+SDL_sem* frameReady = nullptr; // posted when a new scene snapshot is published
 
 uint64_t renderTicks = 0;
 uint64_t renderedFrames = 0;
+uint64_t renderedColumns = 0; // summed over drawn frames, to show how far the resolution controller had to go
+size_t renderScratchPeak = 0; // the render thread's frame arena high-water mark, read after it ends
+int renderScratchFailures = 0;
 char* base = nullptr; // graphics base
 int rowBytes = 0;
 
@@ -27,15 +30,12 @@ volatile ApplicationGlobalState gState = {};
 // voxel rendering on a separate thread
 int RenderWorker(void*)
 {
-    while (base == nullptr) {
-        SDL_Delay(5);
-    }
     SDL_Delay(150); // delay wake up
     while (!quit) {
-        while (!quit && frameWait < 1) {
-            SDL_Delay(1); // pause the thread until a new frame is ready
-        }
+        SDL_SemWait(frameReady); // sleep until a new frame is ready
+        if (quit) break;
 
+        MMFrameReset(); // frame boundary: drop the last frame's scratch memory
         uint32_t st = SDL_GetTicks();
 
         RenderFrame(&gState, screenSurface);
@@ -43,11 +43,11 @@ int RenderWorker(void*)
 
         uint32_t frameSplit = SDL_GetTicks();
         renderTicks += frameSplit - st;
+        renderedColumns += (gState.renderWidth > 0) ? gState.renderWidth : SCREEN_WIDTH;
 
-        frameWait = 0;
         renderedFrames++;
     }
-    drawDone = true;
+    MMFrameState(&renderScratchPeak, nullptr, &renderScratchFailures);
     return 0;
 }
 
@@ -83,6 +83,7 @@ int main()
     StartUp(&gState);
 
     gDataLock = SDL_CreateMutex(); // Initialize lock, one reader at a time
+    frameReady = SDL_CreateSemaphore(0);
     screenSurface = SDL_GetWindowSurface(window); // Get window surface
 
     base = (char*)screenSurface->pixels;
@@ -109,6 +110,7 @@ int main()
     gState.running = true;
     while (gState.running) {
         uint32_t fst = SDL_GetTicks();
+        MMFrameReset(); // frame boundary: drop the last frame's scratch memory
         // Wait for frame render to finish, then swap buffers and do next
 
 
@@ -117,12 +119,11 @@ int main()
         UpdateModel(&gState, frame++, fTime);
 
 #ifdef MULTI_THREAD
-        if (frameWait < 1) {
-            frameWait = 1; // signal to the other thread that it can start
-        }
+        // wake the render thread. If it's still busy, it picks up the newest snapshot when done (frames are dropped, not queued)
+        if (SDL_SemValue(frameReady) < 1) SDL_SemPost(frameReady);
 #else
         // if not threaded, render immediately
-        RenderBuffer(writingScanBuf, base);
+        RenderFrame(&gState, screenSurface);
         SDL_UpdateWindowSurface(window);
 #endif
 
@@ -145,9 +146,10 @@ int main()
     ////////////////////////////////////////////////////////////////////////////////////////////////////
 
     quit = true;
-
-    SDL_Delay(500); // give the render thread time to stop
-    frameWait = 100;
+#ifdef MULTI_THREAD
+    SDL_SemPost(frameReady); // wake the render thread so it can see the quit flag
+    SDL_WaitThread(threadA, nullptr); // wait for the renderer to finish
+#endif
 
     auto endTicks = SDL_GetTicks();
     float avgFPS = static_cast<float>(frame) / (static_cast<float>(endTicks - startTicks) / 1000.0f);
@@ -155,11 +157,15 @@ int main()
     float drawIdleAve = static_cast<float>(renderTicks) / (static_cast<float>(renderedFrames));
     cout << "\r\nFPS ave = " << avgFPS << "\r\nLogic idle % = " << (100 * logicIdleRatio);
     cout << "\r\nFrame drawn = " << renderedFrames << "\r\nDraw time ave = " << (drawIdleAve) << "ms (greater than 15 is under-speed)";
+    if (renderedFrames > 0) cout << "\r\nColumns drawn ave = " << (renderedColumns / renderedFrames) << " of " << SCREEN_WIDTH;
 
+    size_t scratchPeak = 0;
+    int scratchFailures = 0;
+    MMFrameState(&scratchPeak, nullptr, &scratchFailures);
+    cout << "\r\nFrame scratch peak = " << (scratchPeak / 1024) << "KB main, " << (renderScratchPeak / 1024) << "KB render, of "
+         << (FRAME_ARENA_SIZE / 1024) << "KB each (" << (scratchFailures + renderScratchFailures) << " allocations didn't fit)";
+    cout << "\r\nDrops not found = " << MMDropFailures();
 
-#ifdef MULTI_THREAD
-    while (!drawDone) { SDL_Delay(100); }// wait for the renderer to finish
-#endif
 
     // Let the app deallocate etc
     Shutdown(&gState);
@@ -174,9 +180,8 @@ int main()
     }
 #endif
 
-#ifdef MULTI_THREAD
-    SDL_WaitThread(threadA, nullptr);
-#endif
+    SDL_DestroySemaphore(frameReady);
+    frameReady = nullptr;
     SDL_DestroyMutex(gDataLock);
     gDataLock = nullptr;
     SDL_DestroyWindow(window);
@@ -3,10 +3,21 @@
 //
 
 #include <cmath>
+#include <cstring>
 #include "map_synth.h"
 #include "types/MemoryManager.h"
 #include "types/Vector.h"
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SYNTH_AVX2 1
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <xmmintrin.h>
+#include <emmintrin.h>
+#define SYNTH_SSE2 1
+#endif
+
 #define max(a,b) (((a) > (b)) ? (a) : (b))
 #define min(a,b) (((a) < (b)) ? (a) : (b))
 
@@ -71,18 +82,16 @@ double noise(double x, double y, double z) {
 }
 
 
-int heightFunction(int seed, int x, int y) {
-// three octaves of noise:
-
-    double z = seed; // slice through the noise space. This is your 'seed'
-    double lowfreq = 0.01;
-    double midfreq = 0.05;
-    double highfreq = 0.5;
+// Height field noise frequencies, in cycles per texel
+#define HEIGHT_LOW_FREQ 0.01 // main mountain ranges
+#define HEIGHT_MID_FREQ 0.05 // ridges
+#define HEIGHT_HIGH_FREQ 0.5 // crinkles
 
-    double a = noise(x * lowfreq, y * lowfreq, z);
-    double b = noise(x * midfreq, y * midfreq, z);
-    double c = noise(x * highfreq, y * highfreq, z);
+// Samples per `NoiseRow` batch in `GenerateHeightArea`
+#define NOISE_CHUNK 256
 
+// combine three octaves of noise into a height
+inline int heightFromOctaves(double a, double b, double c) {
     double v = 1.2 * // overdrive a little
                (a * 0.6) + // main mountain ranges
                (a * b * 0.4) + // more ridges at higher elevations
@@ -97,6 +106,184 @@ int heightFunction(int seed, int x, int y) {
     return iv;
 }
 
+// Height of one texel, one noise call at a time. `GenerateHeightArea` gives the same heights
+// (to within float rounding) in batches.
+int heightFunction(int seed, int x, int y) {
+// three octaves of noise:
+
+    double z = seed; // slice through the noise space. This is your 'seed'
+
+    double a = noise(x * HEIGHT_LOW_FREQ, y * HEIGHT_LOW_FREQ, z);
+    double b = noise(x * HEIGHT_MID_FREQ, y * HEIGHT_MID_FREQ, z);
+    double c = noise(x * HEIGHT_HIGH_FREQ, y * HEIGHT_HIGH_FREQ, z);
+
+    return heightFromOctaves(a, b, c);
+}
+
+// One lattice cell of a noise row, with the row's y offsets already applied.
+// With a whole-number z, each corner's gradient dot product is gx*x + gy*y with gx and gy in -1..1,
+// so a corner is stored as its x gradient and a constant, and a sample only needs its x offset in the cell.
+typedef struct NoiseCell {
+    float gx00, c00, gx10, c10; // corners at (0,0) and (1,0)
+    float gx01, c01, gx11, c11; // corners at (0,1) and (1,1)
+} NoiseCell;
+
+// `grad` for a z offset of 0, as a 2D gradient
+inline void gradXY(int hash, float* gx, float* gy) {
+    int h = hash & 15;
+    float su = (h & 1) ? -1.0f : 1.0f;
+    float sv = (h & 2) ? -1.0f : 1.0f;
+    *gx = 0.0f;
+    *gy = 0.0f;
+    if (h < 8) *gx += su; else *gy += su;
+    if (h < 4) *gy += sv; else if (h == 12 || h == 14) *gx += sv;
+}
+
+inline float fadef(float t) {
+    return t * t * t * (t * (t * 6.0f - 15.0f) + 10.0f);
+}
+
+// noise for samples [first, end) of a batch, from their cell and offset in it
+inline void noiseSamples(const NoiseCell* cells, float base, float step, float v, int first, int end, float* out) {
+    for (int i = first; i < end; i++) {
+        float rel = base + ((float)i * step);
+        int cell = (int)rel;
+        float xf = rel - (float)cell;
+        const NoiseCell* c = cells + cell;
+
+        float u = fadef(xf);
+        float bottom = (c->gx00 * xf + c->c00) + u * ((c->gx10 * (xf - 1.0f) + c->c10) - (c->gx00 * xf + c->c00));
+        float top = (c->gx01 * xf + c->c01) + u * ((c->gx11 * (xf - 1.0f) + c->c11) - (c->gx01 * xf + c->c01));
+        out[i] = (1.0f + bottom + v * (top - bottom)) * 0.5f;
+    }
+}
+
+void NoiseRow(double x, double y, int z, double step, int count, float* out) {
+    if (out == nullptr || count < 1) return;
+
+    // the lattice row is the same for every sample
+    int Y = (int)floor(y);
+    float yf = (float)(y - Y);
+    float v = fadef(yf);
+    Y &= 255;
+    int Z = z & 255;
+
+    // Samples are done in batches, so the lattice cells of a batch fit in a fixed table
+    NoiseCell cells[NOISE_CHUNK + 2];
+    int chunk = (step > 1.0) ? (int)(NOISE_CHUNK / step) : NOISE_CHUNK;
+    if (chunk < 1) chunk = 1;
+
+    for (int start = 0; start < count; start += chunk) {
+        int n = min(chunk, count - start);
+        double first = x + (start * step);
+        int X0 = (int)floor(first);
+        float base = (float)(first - X0); // position in the batch's first cell
+        float fstep = (float)step;
+
+        // Hash each cell once, for all the samples that fall in it
+        int cellCount = (int)(base + ((n - 1) * step)) + 2;
+        for (int c = 0; c < cellCount; c++) {
+            int X = (X0 + c) & 255;
+            int A = p[X] + Y, AA = p[A] + Z, AB = p[A + 1] + Z;
+            int B = p[X + 1] + Y, BA = p[B] + Z, BB = p[B + 1] + Z;
+
+            float gy;
+            NoiseCell* cell = cells + c;
+            gradXY(p[AA], &cell->gx00, &gy);
+            cell->c00 = gy * yf;
+            gradXY(p[BA], &cell->gx10, &gy);
+            cell->c10 = gy * yf;
+            gradXY(p[AB], &cell->gx01, &gy);
+            cell->c01 = gy * (yf - 1.0f);
+            gradXY(p[BB], &cell->gx11, &gy);
+            cell->c11 = gy * (yf - 1.0f);
+        }
+
+        float* batch = out + start;
+        int i = 0;
+#ifdef SYNTH_AVX2
+        {
+            // gather each corner constant for 8 samples at once
+            const float* table = (const float*)cells;
+            __m256 vBase = _mm256_set1_ps(base);
+            __m256 vStep = _mm256_set1_ps(fstep);
+            __m256 lanes = _mm256_set_ps(7, 6, 5, 4, 3, 2, 1, 0);
+            __m256 one = _mm256_set1_ps(1.0f);
+            __m256 half = _mm256_set1_ps(0.5f);
+            __m256 vv = _mm256_set1_ps(v);
+            for (; i + 8 <= n; i += 8) {
+                __m256 rel = _mm256_add_ps(vBase, _mm256_mul_ps(_mm256_add_ps(_mm256_set1_ps((float)i), lanes), vStep));
+                __m256i cell = _mm256_cvttps_epi32(rel);
+                __m256 xf = _mm256_sub_ps(rel, _mm256_cvtepi32_ps(cell));
+                __m256i idx = _mm256_slli_epi32(cell, 3); // 8 floats per cell
+
+                __m256 gx00 = _mm256_i32gather_ps(table + 0, idx, 4);
+                __m256 c00 = _mm256_i32gather_ps(table + 1, idx, 4);
+                __m256 gx10 = _mm256_i32gather_ps(table + 2, idx, 4);
+                __m256 c10 = _mm256_i32gather_ps(table + 3, idx, 4);
+                __m256 gx01 = _mm256_i32gather_ps(table + 4, idx, 4);
+                __m256 c01 = _mm256_i32gather_ps(table + 5, idx, 4);
+                __m256 gx11 = _mm256_i32gather_ps(table + 6, idx, 4);
+                __m256 c11 = _mm256_i32gather_ps(table + 7, idx, 4);
+
+                __m256 xm = _mm256_sub_ps(xf, one);
+                __m256 u = _mm256_mul_ps(_mm256_mul_ps(_mm256_mul_ps(xf, xf), xf),
+                        _mm256_add_ps(_mm256_mul_ps(xf, _mm256_sub_ps(_mm256_mul_ps(xf, _mm256_set1_ps(6.0f)), _mm256_set1_ps(15.0f))), _mm256_set1_ps(10.0f)));
+
+                __m256 a00 = _mm256_add_ps(_mm256_mul_ps(gx00, xf), c00);
+                __m256 a10 = _mm256_add_ps(_mm256_mul_ps(gx10, xm), c10);
+                __m256 a01 = _mm256_add_ps(_mm256_mul_ps(gx01, xf), c01);
+                __m256 a11 = _mm256_add_ps(_mm256_mul_ps(gx11, xm), c11);
+                __m256 bottom = _mm256_add_ps(a00, _mm256_mul_ps(u, _mm256_sub_ps(a10, a00)));
+                __m256 top = _mm256_add_ps(a01, _mm256_mul_ps(u, _mm256_sub_ps(a11, a01)));
+                __m256 result = _mm256_add_ps(bottom, _mm256_mul_ps(vv, _mm256_sub_ps(top, bottom)));
+                _mm256_storeu_ps(batch + i, _mm256_mul_ps(_mm256_add_ps(one, result), half));
+            }
+        }
+#endif
+#ifdef SYNTH_SSE2
+        {
+            // load the cells of 4 samples, and transpose so each corner constant is one vector
+            __m128 vBase = _mm_set1_ps(base);
+            __m128 vStep = _mm_set1_ps(fstep);
+            __m128 lanes = _mm_set_ps(3, 2, 1, 0);
+            __m128 one = _mm_set1_ps(1.0f);
+            __m128 half = _mm_set1_ps(0.5f);
+            __m128 vv = _mm_set1_ps(v);
+            for (; i + 4 <= n; i += 4) {
+                __m128 rel = _mm_add_ps(vBase, _mm_mul_ps(_mm_add_ps(_mm_set1_ps((float)i), lanes), vStep));
+                __m128i cell = _mm_cvttps_epi32(rel);
+                __m128 xf = _mm_sub_ps(rel, _mm_cvtepi32_ps(cell));
+
+                int idx[4];
+                _mm_storeu_si128((__m128i*)idx, cell);
+                __m128 gx00 = _mm_loadu_ps(&cells[idx[0]].gx00), c00 = _mm_loadu_ps(&cells[idx[1]].gx00);
+                __m128 gx10 = _mm_loadu_ps(&cells[idx[2]].gx00), c10 = _mm_loadu_ps(&cells[idx[3]].gx00);
+                _MM_TRANSPOSE4_PS(gx00, c00, gx10, c10);
+                __m128 gx01 = _mm_loadu_ps(&cells[idx[0]].gx01), c01 = _mm_loadu_ps(&cells[idx[1]].gx01);
+                __m128 gx11 = _mm_loadu_ps(&cells[idx[2]].gx01), c11 = _mm_loadu_ps(&cells[idx[3]].gx01);
+                _MM_TRANSPOSE4_PS(gx01, c01, gx11, c11);
+
+                __m128 xm = _mm_sub_ps(xf, one);
+                __m128 u = _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(xf, xf), xf),
+                        _mm_add_ps(_mm_mul_ps(xf, _mm_sub_ps(_mm_mul_ps(xf, _mm_set1_ps(6.0f)), _mm_set1_ps(15.0f))), _mm_set1_ps(10.0f)));
+
+                __m128 a00 = _mm_add_ps(_mm_mul_ps(gx00, xf), c00);
+                __m128 a10 = _mm_add_ps(_mm_mul_ps(gx10, xm), c10);
+                __m128 a01 = _mm_add_ps(_mm_mul_ps(gx01, xf), c01);
+                __m128 a11 = _mm_add_ps(_mm_mul_ps(gx11, xm), c11);
+                __m128 bottom = _mm_add_ps(a00, _mm_mul_ps(u, _mm_sub_ps(a10, a00)));
+                __m128 top = _mm_add_ps(a01, _mm_mul_ps(u, _mm_sub_ps(a11, a01)));
+                __m128 result = _mm_add_ps(bottom, _mm_mul_ps(vv, _mm_sub_ps(top, bottom)));
+                _mm_storeu_ps(batch + i, _mm_mul_ps(_mm_add_ps(one, result), half));
+            }
+        }
+#endif
+        // scalar fallback, and any samples left over
+        noiseSamples(cells, base, fstep, v, i, n, batch);
+    }
+}
+
 inline void set(BYTE* map, int idx, int r, int g, int b){
     map[idx++]=(BYTE)r;
     map[idx++]=(BYTE)g;
@@ -110,11 +297,11 @@ inline rgbSample get(const BYTE* map, int idx){
     return s;
 }
 
-void heightToColor(int size, const BYTE* heightMap, BYTE* colorMap) {
+void heightToColor(int size, const BYTE* heightMap, BYTE* colorMap, int firstRow, int endRow) {
     int rowWidth = size * 3; // number of bytes in an image row
 
     // main color
-    for (int y = 0; y < size; y++) {
+    for (int y = firstRow; y < endRow; y++) {
         int yoff = y * rowWidth;
         int yoffH = y * size;
 
@@ -151,78 +338,251 @@ void heightToColor(int size, const BYTE* heightMap, BYTE* colorMap) {
     }
 }
 
-// falloff = how steep the shadows are. lower = sun is closer to horizon.
-void heightToShadow(int size, int direction, double falloff, const BYTE* heightMap, BYTE* shadowMap) {
-    int start = 0;
-    int end = size-1;
-    int initial = direction > 0 ? start : end;
-
-    for (int y = 0; y < size; y++) {
-        int yoff = y * size;
-        double shadow = 0; // what height is in shadow
-
-        for (int x = initial; x >= start && x <= end; x += direction) {
-            int idx = yoff + x;
+// Light map settings:
+// Sun shadows fade in over this many height units below the shadow line
+#define LIGHT_PENUMBRA 8
+// Light level (0..255) of a texel that gets no sun at all
+#define LIGHT_AMBIENT 115
+// Distance in texels to the neighbours used for the slope. More is smoother, but loses small bumps
+#define LIGHT_SLOPE_RADIUS 2
+// Distance in texels to the neighbours that shade a hollow (ambient occlusion)
+#define LIGHT_AO_RADIUS 4
+// Most that ambient occlusion can take off the light level
+#define LIGHT_AO_MAX 160
+// Same water line as `heightToColor`. The water surface is flat, whatever is under it
+#define LIGHT_WATER_HEIGHT 51
+
+// Light level for rows [firstRow, endRow) of a height map, from sun visibility, slope and ambient occlusion.
+// Rows are independent of each other, and only read the height map.
+void heightToLight(int size, double sunAngle, const BYTE* heightMap, BYTE* lightMap, int firstRow, int endRow) {
+    double sunrad = 0.017453 * sunAngle;
+    bool sunUp = sunAngle > 0 && sunAngle < 180;
+    int direction = sunAngle < 90 ? 1 : -1; // direction the sun shines along rows
+
+    // how steep the shadows are, in 8.8 height units per texel. lower = sun is closer to horizon.
+    int falloff = (int)(sin(sunrad) * (255.0 * 256.0 / 100.0));
+    // unit vector toward the sun, in texels and height units
+    float sunX = (float)-cos(sunrad);
+    float sunZ = (float)sin(sunrad);
+    int last = size - 1;
+
+    for (int y = firstRow; y < endRow; y++) {
+        const BYTE* row = heightMap + (y * size);
+        const BYTE* above = heightMap + (max(0, y - LIGHT_SLOPE_RADIUS) * size);
+        const BYTE* below = heightMap + (min(last, y + LIGHT_SLOPE_RADIUS) * size);
+        const BYTE* farAbove = heightMap + (max(0, y - LIGHT_AO_RADIUS) * size);
+        const BYTE* farBelow = heightMap + (min(last, y + LIGHT_AO_RADIUS) * size);
+        BYTE* out = lightMap + (y * size);
+
+        // Pass 1: sweep toward the sun's direction, carrying the shadow line. Store sun visibility 0..255
+        if (sunUp) {
+            int shadow = 0; // what height is in shadow, 8.8
+            int initial = direction > 0 ? 0 : last;
+            for (int x = initial; x >= 0 && x <= last; x += direction) {
+                int h = max(row[x], LIGHT_WATER_HEIGHT) << 8;
+                shadow = max(h, shadow) - falloff;
+
+                int depth = (shadow - h) / LIGHT_PENUMBRA; // how far into shadow. 256 = fully dark
+                out[x] = (BYTE)(255 - min(255, max(0, depth)));
+            }
+        } else {
+            for (int x = 0; x < size; x++) out[x] = 0;
+        }
 
-            double s = heightMap[idx] / 255.0; // sample height, put in range 0..1
-            shadow = max(s, shadow) - falloff;
+        // Pass 2: every texel on its own, so this vectorises. Diffuse from the surface slope, then occlusion
+        for (int x = 0; x < size; x++) {
+            int xl = max(0, x - LIGHT_SLOPE_RADIUS), xr = min(last, x + LIGHT_SLOPE_RADIUS);
+            int h = max(row[x], LIGHT_WATER_HEIGHT);
+
+            float gx = (float)(max(row[xr], LIGHT_WATER_HEIGHT) - max(row[xl], LIGHT_WATER_HEIGHT)) * (0.5f / LIGHT_SLOPE_RADIUS);
+            float gy = (float)(max(below[x], LIGHT_WATER_HEIGHT) - max(above[x], LIGHT_WATER_HEIGHT)) * (0.5f / LIGHT_SLOPE_RADIUS);
+            float diffuse = (sunZ - (gx * sunX)) / sqrtf((gx * gx) + (gy * gy) + 1.0f); // normal (-gx,-gy,1) dot sun
+            diffuse = fminf(1.0f, fmaxf(0.0f, diffuse));
+
+            // hollows get less sky
+            int occlusion = max(0, max(row[max(0, x - LIGHT_AO_RADIUS)], LIGHT_WATER_HEIGHT) - h)
+                    + max(0, max(row[min(last, x + LIGHT_AO_RADIUS)], LIGHT_WATER_HEIGHT) - h)
+                    + max(0, max(farAbove[x], LIGHT_WATER_HEIGHT) - h)
+                    + max(0, max(farBelow[x], LIGHT_WATER_HEIGHT) - h);
+            int ao = 255 - min(LIGHT_AO_MAX, occlusion * 2);
+
+            int sun = (int)((float)out[x] * diffuse); // 0..255
+            int light = LIGHT_AMBIENT + (((255 - LIGHT_AMBIENT) * sun) / 255);
+            out[x] = (BYTE)((light * ao) / 255);
+        }
+    }
+}
 
-            // darker if in shadow
-            if (shadow > s) {
-                shadowMap[idx] = (BYTE)1;
-            } else {
-                shadowMap[idx] = (BYTE)0;
-            }
+// Color map with the light map applied, packed 0xHHRRGGBB with the height map
+void colorToLit(int size, const BYTE* colorMap, const BYTE* lightMap, const BYTE* heightMap, uint32_t* litMap, int firstRow, int endRow) {
+    for (int y = firstRow; y < endRow; y++) {
+        const BYTE* color = colorMap + (y * size * 3);
+        const BYTE* light = lightMap + (y * size);
+        const BYTE* height = (heightMap == nullptr) ? nullptr : heightMap + (y * size);
+        uint32_t* out = litMap + (y * size);
+
+        for (int x = 0; x < size; x++) {
+            uint32_t l = light[x] + 1u; // 1..256, so full light leaves the color as it is
+            uint32_t r = (color[x * 3] * l) >> 8;
+            uint32_t g = (color[(x * 3) + 1] * l) >> 8;
+            uint32_t b = (color[(x * 3) + 2] * l) >> 8;
+            uint32_t h = (height == nullptr) ? 0 : height[x];
+            out[x] = (h << 24) | (r << 16) | (g << 8) | b;
         }
     }
 }
 
+// 3x3 kernel blur of the texel at byte offset `xoff`, from the rows above, at and below it
+inline void blurTexel(const BYTE* above, const BYTE* row, const BYTE* below, int xoff, BYTE* out) {
+    auto c_tl = get(above, xoff - 3);
+    auto c_ml = get(row, xoff - 3);
+    auto c_bl = get(below, xoff - 3);
+
+    auto c_tc = get(above, xoff);
+    auto c_mc = get(row, xoff);
+    auto c_bc = get(below, xoff);
+
+    auto c_tr = get(above, xoff + 3);
+    auto c_mr = get(row, xoff + 3);
+    auto c_br = get(below, xoff + 3);
+
+    double r = c_tl.r * 0.5 + c_tc.r * 0.75 + c_tr.r * 0.5 +
+            c_ml.r * 0.75 + c_mc.r * 1.0 + c_mr.r * 0.75 +
+            c_bl.r * 0.5 + c_bc.r * 0.75 + c_br.r * 0.5;
+
+    double g = c_tl.g * 0.5 + c_tc.g * 0.75 + c_tr.g * 0.5 +
+            c_ml.g * 0.75 + c_mc.g * 1.0 + c_mr.g * 0.75 +
+            c_bl.g * 0.5 + c_bc.g * 0.75 + c_br.g * 0.5;
+
+    double b = c_tl.b * 0.5 + c_tc.b * 0.75 + c_tr.b * 0.5 +
+            c_ml.b * 0.75 + c_mc.b * 1.0 + c_mr.b * 0.75 +
+            c_bl.b * 0.5 + c_bc.b * 0.75 + c_br.b * 0.5;
+
+    set(out, xoff, (int)r / 6, (int)g / 6, (int)b / 6);
+}
+
 void blur(int size, BYTE* colorMap) {
     int rowWidth = size * 3; // number of bytes in an image row
 
     // simple kernel blur
     for (int y = 1; y < size - 1; y++) {
-        int yoff_1 = (y - 1) * rowWidth;
-        int yoff_2 = (y) * rowWidth;
-        int yoff_3 = (y + 1) * rowWidth;
+        BYTE* above = colorMap + ((y - 1) * rowWidth);
+        BYTE* row = colorMap + (y * rowWidth);
+        BYTE* below = colorMap + ((y + 1) * rowWidth);
 
         for (int x = 1, xoff = 0; x < size - 1; x++, xoff += 3) {
-            auto c_tl = get(colorMap, yoff_1 + xoff - 3);
-            auto c_ml = get(colorMap, yoff_2 + xoff - 3);
-            auto c_bl = get(colorMap, yoff_3 + xoff - 3);
-
+            blurTexel(above, row, below, xoff, row);
+        }
+    }
+}
 
-            auto c_tc = get(colorMap, yoff_1 + xoff);
-            auto c_mc = get(colorMap, yoff_2 + xoff);
-            auto c_bc = get(colorMap, yoff_3 + xoff);
+// Separable blur: a [3 4 3] tent across each row, then down each column, so 3x3 weights of 9,12,9 / 12,16,12 / 9,12,9
+// out of 100. Close to the old kernel (corners 0.56 of the center rather than 0.5).
+// Both passes work on single bytes three apart, so every channel is done at once, and the sums fit 16 bits.
+
+// Horizontal pass of one row: bytes [3, rowWidth - 3) of `sums`
+inline void blurAcross(const BYTE* row, uint16_t* sums, int rowWidth) {
+    int i = 3, end = rowWidth - 3;
+#ifdef SYNTH_SSE2
+    {
+        __m128i zero = _mm_setzero_si128();
+        for (; i + 8 <= end; i += 8) {
+            __m128i left = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(row + i - 3)), zero);
+            __m128i center = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(row + i)), zero);
+            __m128i right = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(row + i + 3)), zero);
+            __m128i sides = _mm_add_epi16(left, right);
+            __m128i sum = _mm_add_epi16(_mm_add_epi16(sides, _mm_slli_epi16(sides, 1)), _mm_slli_epi16(center, 2));
+            _mm_storeu_si128((__m128i*)(sums + i), sum);
+        }
+    }
+#endif
+    for (; i < end; i++) {
+        sums[i] = (uint16_t)((3 * (row[i - 3] + row[i + 3])) + (4 * row[i]));
+    }
+}
 
-            auto c_tr = get(colorMap, yoff_1 + xoff + 3);
-            auto c_mr = get(colorMap, yoff_2 + xoff + 3);
-            auto c_br = get(colorMap, yoff_3 + xoff + 3);
+// Vertical pass: bytes [3, rowWidth - 3) of an output row from the horizontal sums of the rows above, at and below it.
+// (sum + 50) * 656 >> 16 is close to rounding sum / 100, and is the same in every path.
+inline void blurDown(const uint16_t* above, const uint16_t* center, const uint16_t* below, BYTE* out, int rowWidth) {
+    int i = 3, end = rowWidth - 3;
+#ifdef SYNTH_SSE2
+    {
+        __m128i bias = _mm_set1_epi16(50);
+        __m128i scale = _mm_set1_epi16(656);
+        for (; i + 8 <= end; i += 8) {
+            __m128i sides = _mm_add_epi16(_mm_loadu_si128((const __m128i*)(above + i)), _mm_loadu_si128((const __m128i*)(below + i)));
+            __m128i mid = _mm_loadu_si128((const __m128i*)(center + i));
+            __m128i sum = _mm_add_epi16(_mm_add_epi16(sides, _mm_slli_epi16(sides, 1)), _mm_slli_epi16(mid, 2)); // at most 25500
+            __m128i value = _mm_mulhi_epu16(_mm_add_epi16(sum, bias), scale);
+            _mm_storel_epi64((__m128i*)(out + i), _mm_packus_epi16(value, value));
+        }
+    }
+#endif
+    for (; i < end; i++) {
+        uint32_t sum = (3u * (above[i] + below[i])) + (4u * center[i]);
+        out[i] = (BYTE)(((sum + 50u) * 656u) >> 16);
+    }
+}
 
-            double r = c_tl.r * 0.5 + c_tc.r * 0.75 + c_tr.r * 0.5 +
-                    c_ml.r * 0.75 + c_mc.r * 1.0 + c_mr.r * 0.75 +
-                    c_bl.r * 0.5 + c_bc.r * 0.75 + c_br.r * 0.5;
+// Blur rows [firstRow, endRow) of `colorMap` into `blurred`. Edge texels are copied as they are.
+// Each source row goes through the horizontal pass once, into a ring of three rows, before any output row that
+// would overwrite it is written. So the result doesn't depend on order, and `blurred` can be `colorMap`.
+void blurRows(int size, const BYTE* colorMap, BYTE* blurred, int firstRow, int endRow) {
+    int rowWidth = size * 3; // number of bytes in an image row
+    uint16_t ring[3][BLUR_MAX_SIZE * 3];
 
-            double g = c_tl.g * 0.5 + c_tc.g * 0.75 + c_tr.g * 0.5 +
-                    c_ml.g * 0.75 + c_mc.g * 1.0 + c_mr.g * 0.75 +
-                    c_bl.g * 0.5 + c_bc.g * 0.75 + c_br.g * 0.5;
+    for (int y = firstRow; y < endRow; y++) { // edge rows
+        if (y > 0 && y < size - 1) continue;
+        if (blurred != colorMap) memcpy(blurred + (y * rowWidth), colorMap + (y * rowWidth), (size_t)rowWidth);
+    }
 
-            double b = c_tl.b * 0.5 + c_tc.b * 0.75 + c_tr.b * 0.5 +
-                    c_ml.b * 0.75 + c_mc.b * 1.0 + c_mr.b * 0.75 +
-                    c_bl.b * 0.5 + c_bc.b * 0.75 + c_br.b * 0.5;
+    int first = max(1, firstRow), end = min(size - 1, endRow);
+    if (first >= end) return;
 
+    blurAcross(colorMap + ((first - 1) * rowWidth), ring[(first - 1) % 3], rowWidth);
+    blurAcross(colorMap + (first * rowWidth), ring[first % 3], rowWidth);
+    for (int y = first; y < end; y++) {
+        blurAcross(colorMap + ((y + 1) * rowWidth), ring[(y + 1) % 3], rowWidth); // not written yet, even in place
 
-            set(colorMap, yoff_2 + xoff, (int)r / 6, (int)g / 6, (int)b / 6);
+        const BYTE* row = colorMap + (y * rowWidth);
+        BYTE* out = blurred + (y * rowWidth);
+        if (out != row) {
+            for (int i = 0; i < 3; i++) out[i] = row[i];
+            for (int i = rowWidth - 3; i < rowWidth; i++) out[i] = row[i];
         }
+        blurDown(ring[(y - 1) % 3], ring[y % 3], ring[(y + 1) % 3], out, rowWidth);
     }
 }
 
 void GenerateHeight(int size, int seed, BYTE *map) {
-    for (int y = 0; y < size; ++y) {
+    GenerateHeightArea(size, seed, 0, 0, map);
+}
+
+void GenerateHeightArea(int size, int seed, int originX, int originY, BYTE *map) {
+    GenerateHeightAreaRows(size, seed, originX, originY, map, 0, size);
+}
+
+void GenerateHeightAreaRows(int size, int seed, int originX, int originY, BYTE *map, int firstRow, int endRow) {
+    if (map == nullptr) return;
+    if (firstRow < 0) firstRow = 0;
+    if (endRow > size) endRow = size;
+
+    // three octaves for a batch of texels along a row
+    float a[NOISE_CHUNK], b[NOISE_CHUNK], c[NOISE_CHUNK];
+
+    for (int y = firstRow; y < endRow; ++y) {
         int yoff = y * size;
-        for (int x = 0; x < size; ++x) {
-            map[x + yoff] = (BYTE)heightFunction(seed, x,y);
+        int gy = originY + y;
+        for (int x = 0; x < size; x += NOISE_CHUNK) {
+            int n = min(NOISE_CHUNK, size - x);
+            int gx = originX + x;
+            NoiseRow(gx * HEIGHT_LOW_FREQ, gy * HEIGHT_LOW_FREQ, seed, HEIGHT_LOW_FREQ, n, a);
+            NoiseRow(gx * HEIGHT_MID_FREQ, gy * HEIGHT_MID_FREQ, seed, HEIGHT_MID_FREQ, n, b);
+            NoiseRow(gx * HEIGHT_HIGH_FREQ, gy * HEIGHT_HIGH_FREQ, seed, HEIGHT_HIGH_FREQ, n, c);
+
+            for (int i = 0; i < n; i++) {
+                map[x + i + yoff] = (BYTE)heightFromOctaves(a[i], b[i], c[i]);
+            }
         }
     }
 }
@@ -232,22 +592,162 @@ void GenerateColor(int size, const BYTE *height, BYTE *color) {
     if (height == nullptr) return;
     if (size < 1) return;
 
-    heightToColor(size, height, color);
+    heightToColor(size, height, color, 0, size);
+    BlurColorRows(size, color, color, 0, size);
+}
+
+void BlurColorReference(int size, BYTE *color) {
+    if (color == nullptr) return;
+    if (size < 1) return;
+
     blur(size, color);
 }
 
+void GenerateBaseColorRows(int size, const BYTE *height, BYTE *color, int firstRow, int endRow) {
+    if (color == nullptr) return;
+    if (height == nullptr) return;
+    if (firstRow < 0) firstRow = 0;
+    if (endRow > size) endRow = size;
+
+    heightToColor(size, height, color, firstRow, endRow);
+}
+
+void BlurColorRows(int size, const BYTE *color, BYTE *blurred, int firstRow, int endRow) {
+    if (color == nullptr) return;
+    if (blurred == nullptr) return;
+    if (size < 1 || size > BLUR_MAX_SIZE) return;
+    if (firstRow < 0) firstRow = 0;
+    if (endRow > size) endRow = size;
+
+    blurRows(size, color, blurred, firstRow, endRow);
+}
+
 // sun angle 0..180
-void GenerateShadow(int size, const BYTE *height, BYTE *shadow, double sunAngle) {
-    if (shadow == nullptr) return;
+void GenerateLight(int size, const BYTE *height, BYTE *light, double sunAngle) {
+    GenerateLightRows(size, height, light, sunAngle, 0, size);
+}
+
+void GenerateLightRows(int size, const BYTE *height, BYTE *light, double sunAngle, int firstRow, int endRow) {
+    if (light == nullptr) return;
     if (height == nullptr) return;
     if (size < 1) return;
+    if (firstRow < 0) firstRow = 0;
+    if (endRow > size) endRow = size;
 
     // TODO: pass in a sun-point, or time of day and calculate the falloff and direction
-    double sunrad = 0.017453 * sunAngle;
-    double falloff = sin(sunrad) / 100;
-    int direction = sunAngle < 90 ? 1 : -1;
+    heightToLight(size, sunAngle, height, light, firstRow, endRow);
+}
 
-    heightToShadow(size, direction, falloff, height, shadow);
+void GenerateLitColor(int size, const BYTE *color, const BYTE *light, const BYTE *height, uint32_t *lit) {
+    GenerateLitColorRows(size, color, light, height, lit, 0, size);
+}
+
+void GenerateLitColorRows(int size, const BYTE *color, const BYTE *light, const BYTE *height, uint32_t *lit, int firstRow, int endRow) {
+    if (lit == nullptr) return;
+    if (color == nullptr) return;
+    if (light == nullptr) return;
+    if (firstRow < 0) firstRow = 0;
+    if (endRow > size) endRow = size;
+
+    colorToLit(size, color, light, height, lit, firstRow, endRow);
+}
+
+int MipChainBytes(int size, int bytesPerTexel) {
+    int total = 0;
+    for (int levelSize = size / 2; levelSize > 0; levelSize /= 2) {
+        total += levelSize * levelSize * bytesPerTexel;
+    }
+    return total;
+}
+
+BYTE* MipLevel(BYTE* mips, int size, int bytesPerTexel, int level) {
+    if (mips == nullptr || level < 1) return nullptr;
+
+    int offset = 0;
+    for (int l = 1; l < level; l++) {
+        int levelSize = size >> l;
+        offset += levelSize * levelSize * bytesPerTexel;
+    }
+    return mips + offset;
+}
+
+void GenerateMips(int size, int bytesPerTexel, const BYTE* map, BYTE* mips) {
+    if (map == nullptr) return;
+    if (mips == nullptr) return;
+
+    const BYTE* src = map;
+    BYTE* dst = mips;
+    int srcRow = size * bytesPerTexel;
+
+    for (int levelSize = size / 2; levelSize > 0; levelSize /= 2) {
+        for (int y = 0; y < levelSize; y++) {
+            const BYTE* top = src + (y * 2 * srcRow);
+            const BYTE* bottom = top + srcRow;
+            BYTE* out = dst + (y * levelSize * bytesPerTexel);
+
+            for (int x = 0; x < levelSize * bytesPerTexel; x += bytesPerTexel) {
+                int sx = x * 2;
+                for (int c = 0; c < bytesPerTexel; c++) { // average each channel of a 2x2 block
+                    int sum = top[sx + c] + top[sx + bytesPerTexel + c] + bottom[sx + c] + bottom[sx + bytesPerTexel + c];
+                    out[x + c] = (BYTE)((sum + 2) / 4);
+                }
+            }
+        }
+
+        src = dst;
+        dst += levelSize * levelSize * bytesPerTexel;
+        srcRow = levelSize * bytesPerTexel;
+    }
+}
+
+void GenerateMaxMips(int size, const BYTE* map, BYTE* mips) {
+    if (map == nullptr) return;
+    if (mips == nullptr) return;
+
+    const BYTE* src = map;
+    BYTE* dst = mips;
+    int srcRow = size;
+
+    for (int levelSize = size / 2; levelSize > 0; levelSize /= 2) {
+        for (int y = 0; y < levelSize; y++) {
+            const BYTE* top = src + (y * 2 * srcRow);
+            const BYTE* bottom = top + srcRow;
+            BYTE* out = dst + (y * levelSize);
+
+            for (int x = 0; x < levelSize; x++) {
+                int sx = x * 2;
+                BYTE high = max(max(top[sx], top[sx + 1]), max(bottom[sx], bottom[sx + 1]));
+                out[x] = high;
+            }
+        }
+
+        src = dst;
+        dst += levelSize * levelSize;
+        srcRow = levelSize;
+    }
+}
+
+void GenerateMortonMips(int size, int bytesPerTexel, const BYTE* map, BYTE* mips) {
+    if (map == nullptr) return;
+    if (mips == nullptr) return;
+
+    const BYTE* src = map;
+    BYTE* dst = mips;
+
+    // each 2x2 block is 4 texels in a row, and the blocks are in Morton order at the next level
+    for (int count = (size / 2) * (size / 2); count > 0; count /= 4) {
+        for (int t = 0; t < count; t++) {
+            const BYTE* block = src + (t * 4 * bytesPerTexel);
+            BYTE* out = dst + (t * bytesPerTexel);
+            for (int c = 0; c < bytesPerTexel; c++) { // average each channel of the block
+                int sum = block[c] + block[bytesPerTexel + c] + block[(2 * bytesPerTexel) + c] + block[(3 * bytesPerTexel) + c];
+                out[c] = (BYTE)((sum + 2) / 4);
+            }
+        }
+
+        src = dst;
+        dst += count * bytesPerTexel;
+    }
 }
 
 void MapSynthInit() {
@@ -5,18 +5,78 @@
 #ifndef SDLBASE_MAP_SYNTH_H
 #define SDLBASE_MAP_SYNTH_H
 
+#include <cstdint>
 #include "types/general.h"
 
 void MapSynthInit();
 void MapSynthDispose();
 
+// Perlin noise (0..1) at `count` points along a row: (x + (i * step), y, z) for i = 0 to count-1.
+// Gives the same values as single point noise, to float precision, several points at a time.
+void NoiseRow(double x, double y, int z, double step, int count, float* out);
+
 // Create a random height field from a seed
 void GenerateHeight(int size, int seed, BYTE* map);
 
+// Fill a `size` square of the same height field, starting at global map position (originX, originY).
+// Areas that touch or overlap line up exactly, so a large world can be built from separate tiles.
+void GenerateHeightArea(int size, int seed, int originX, int originY, BYTE* map);
+
+// Update rows [firstRow, endRow) of a height area. Rows are independent of each other.
+void GenerateHeightAreaRows(int size, int seed, int originX, int originY, BYTE* map, int firstRow, int endRow);
+
 // Create a color map to match a height map
 void GenerateColor(int size, const BYTE* height, BYTE* color);
 
-// Create a shadow map to match a height map
-void GenerateShadow(int size, const BYTE* height, BYTE* shadow, double sunAngle);
+// Color rows [firstRow, endRow) of a map before blurring. Each row only reads the same row of the height map.
+void GenerateBaseColorRows(int size, const BYTE* height, BYTE* color, int firstRow, int endRow);
+
+// Widest map `BlurColorRows` will take. Its row buffers are on the stack
+#define BLUR_MAX_SIZE 1024
+
+// Blur rows [firstRow, endRow) of a color map into `blurred`. Edge texels are copied as they are.
+// Reads one row either side. `blurred` can be `color` for a single call, but bands of rows that are blurred at
+// the same time need separate maps.
+void BlurColorRows(int size, const BYTE* color, BYTE* blurred, int firstRow, int endRow);
+
+// The original 3x3 kernel blur, in place and in scan order, so each texel sees the already blurred texels
+// above and to the left of it. Kept only to compare against in the benchmark.
+void BlurColorReference(int size, BYTE* color);
+
+// Create a light map to match a height map. Each texel is a light level, 0 = darkest, 255 = full sun.
+// Combines soft sun shadows, the slope of the ground toward the sun, and ambient occlusion.
+void GenerateLight(int size, const BYTE* height, BYTE* light, double sunAngle);
+
+// Update rows [firstRow, endRow) of a light map. The sun moves along map rows, so each row can be done on its own.
+void GenerateLightRows(int size, const BYTE* height, BYTE* light, double sunAngle, int firstRow, int endRow);
+
+// Lit texels pack everything the ray marcher reads into one word: 0xHHRRGGBB, height in the top byte
+#define TEXEL_HEIGHT(t) ((t) >> 24)
+#define TEXEL_COLOR(t) ((t) & 0x00FFFFFF)
+
+// Apply a light map to a color map, and pack each lit color with its height (see `TEXEL_HEIGHT`) ready to draw.
+// `height` can be null, leaving the top byte zero.
+void GenerateLitColor(int size, const BYTE* color, const BYTE* light, const BYTE* height, uint32_t* lit);
+
+// Update rows [firstRow, endRow) of a lit texel map
+void GenerateLitColorRows(int size, const BYTE* color, const BYTE* light, const BYTE* height, uint32_t* lit, int firstRow, int endRow);
+
+// Number of bytes needed to hold all the reduced levels of a map (half size, quarter size, ... 1x1)
+int MipChainBytes(int size, int bytesPerTexel);
+
+// Fill `mips` with successively halved copies of `map`. Each texel is the average of a 2x2 block in the level above.
+// `mips` should be at least `MipChainBytes` in size.
+void GenerateMips(int size, int bytesPerTexel, const BYTE* map, BYTE* mips);
+
+// The same as `GenerateMips`, for a map stored in Morton order (x and y bits interleaved). The mips are in
+// Morton order too, and every texel has the same value as it would from `GenerateMips`.
+void GenerateMortonMips(int size, int bytesPerTexel, const BYTE* map, BYTE* mips);
+
+// Like `GenerateMips` for a one byte map, but each texel is the highest of its 2x2 block, not the average.
+// Level `n` then holds the highest texel of each 2^n square block of the full map.
+void GenerateMaxMips(int size, const BYTE* map, BYTE* mips);
+
+// Get the start of a reduced map level (1 = half size) in a chain created by `GenerateMips`
+BYTE* MipLevel(BYTE* mips, int size, int bytesPerTexel, int level);
 
 #endif //SDLBASE_MAP_SYNTH_H
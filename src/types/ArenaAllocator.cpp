@@ -1,5 +1,6 @@
 #include "ArenaAllocator.h"
 #include "RawData.h"
+#include "MathBits.h"
 
 #include <cstdlib>
 
@@ -10,7 +11,15 @@
 #endif
 
 // maximum number of references in a zone before we give up.
-#define ZONE_MAX_REFS 65000
+#define ZONE_MAX_REFS 0x7FFFFFFF
+
+// Zones with room left are kept in lists by how much room. List `c` holds zones with at least 2^c bytes free
+// (and less than 2^(c+1)). Empty zones have a list of their own, and full zones are in none.
+// Zones are at most 2^30 bytes, so the partly full lists never reach the empty one
+#define FREE_CLASS_EMPTY 31
+#define FREE_CLASS_COUNT 32
+// end of a zone list
+#define NO_ZONE (-1)
 
 typedef struct Arena {
 #ifdef ARENA_DEBUG
@@ -24,28 +33,84 @@ typedef struct Arena {
     // Top of memory
     void* _limit;
 
-    // Pointer to array of ushort, length is equal to _zoneCount.
+    // Pointer to array of uint, length is equal to _zoneCount.
     // Each element is offset of next pointer to allocate. Zero indicates an empty zone.
     // This is also the base of allocated memory
-    uint16_t* _headsPtr;
+    uint32_t* _headsPtr;
+
+    // Pointer to array of uint, length is equal to _zoneCount.
+    // Each element is number of references claimed against the zone.
+    uint32_t* _refCountsPtr;
+
+    // Pointers to arrays of int, length is equal to _zoneCount.
+    // Each zone's neighbours in the free list for its size class, or NO_ZONE at either end
+    int32_t* _nextFreePtr;
+    int32_t* _prevFreePtr;
+
+    // First zone in each free list, or NO_ZONE. See `FREE_CLASS_COUNT`
+    int32_t _freeLists[FREE_CLASS_COUNT];
 
-    // Pointer to array of ushort, length is equal to _arenaCount.
-    // Each element is number of references claimed against the arena.
-    uint16_t* _refCountsPtr;
+    // Bit `c` is set when free list `c` has any zones
+    uint32_t _freeClasses;
 
     // The most recent arena that had a successful alloc or clear
     int _currentZone;
 
     // Count of available arenas. This is the limit of memory
     int _zoneCount;
+
+    // Bytes in each zone, which is the largest single allocation. Always a power of two, `1 << _zoneShift`
+    uint32_t _zoneSize;
+    int _zoneShift;
 } Arena;
 
+
+
+// Which free list a zone with this head belongs in, or NO_ZONE if it's full
+inline int FreeClass(Arena* a, uint32_t head) {
+    if (head == 0) return FREE_CLASS_EMPTY;
+    if (head >= a->_zoneSize) return NO_ZONE;
+    return highestBit(a->_zoneSize - head);
+}
+
+void LinkFreeZone(Arena* a, int zoneIndex, int freeClass) {
+    if (freeClass == NO_ZONE) return;
+    int first = a->_freeLists[freeClass];
+    a->_prevFreePtr[zoneIndex] = NO_ZONE;
+    a->_nextFreePtr[zoneIndex] = first;
+    if (first != NO_ZONE) a->_prevFreePtr[first] = zoneIndex;
+    a->_freeLists[freeClass] = zoneIndex;
+    a->_freeClasses |= 1u << freeClass;
+}
+
+void UnlinkFreeZone(Arena* a, int zoneIndex, int freeClass) {
+    if (freeClass == NO_ZONE) return;
+    int prev = a->_prevFreePtr[zoneIndex];
+    int next = a->_nextFreePtr[zoneIndex];
+    if (prev != NO_ZONE) a->_nextFreePtr[prev] = next;
+    else a->_freeLists[freeClass] = next;
+    if (next != NO_ZONE) a->_prevFreePtr[next] = prev;
+    if (a->_freeLists[freeClass] == NO_ZONE) a->_freeClasses &= ~(1u << freeClass);
+}
+
 // Create a new arena for memory management. Size is the maximum size for the whole
 // arena. Fragmentation may make the usable size smaller. Size should be a multiple of ARENA_ZONE_SIZE
 Arena* NewArena(size_t size) {
-    int expectedZoneCount = (int)(size / ARENA_ZONE_SIZE) + 1;
+    return NewArenaWithZoneSize(size, ARENA_ZONE_SIZE);
+}
+
+// Create a new arena whose zones are `zoneSize` bytes, rounded up to a power of two
+Arena* NewArenaWithZoneSize(size_t size, size_t zoneSize) {
+    if (zoneSize < 1) zoneSize = ARENA_ZONE_SIZE;
+    if (zoneSize > ARENA_MAX_ZONE_SIZE) return nullptr;
+    int zoneShift = (zoneSize > 1) ? highestBit((uint32_t)(zoneSize - 1)) + 1 : 0;
+    zoneSize = (size_t)1 << zoneShift;
 
-    auto realMemory = calloc(1, size + ARENA_ZONE_SIZE);
+    int expectedZoneCount = (int)(size / zoneSize) + 1;
+
+    // heads and ref counts, then free list links, for each zone
+    auto sizeOfTables = (sizeof(uint32_t) * 2 + sizeof(int32_t) * 2) * (expectedZoneCount - 1);
+    auto realMemory = calloc(1, size + sizeOfTables);
     if (realMemory == nullptr) return nullptr;
 
     auto result = (Arena*)calloc(1, sizeof(Arena));
@@ -55,34 +120,42 @@ Arena* NewArena(size_t size) {
     }
 
     result->_start = realMemory;
-    result->_limit = byteOffset(realMemory, size - 1);
-    
+
 #ifdef ARENA_DEBUG
     result->_marked = false;
 #endif
 
-    // with 64KB arenas (ushort) and 1GB of RAM, we get 16384 arenas.
-    // recording only heads and refs would take 64KB of management space
-    // recording heads, refs and back-step (an optimisation for very short-lived items) would use 96KB of management space.
-    // This seems pretty reasonable.
+    // with 64KB zones and 1GB of RAM, we get 16384 zones.
+    // recording heads and refs takes 128KB of management space, and the free list links another 128KB.
+    // Bigger zones need proportionally less.
     result->_zoneCount = expectedZoneCount - 1;
     result->_currentZone = 0;
+    result->_zoneSize = (uint32_t)zoneSize;
+    result->_zoneShift = zoneShift;
 
     // Allow space for arena tables, store adjusted base
-    auto sizeOfTables = sizeof(uint16_t) * result->_zoneCount;
-    result->_headsPtr = (uint16_t*)result->_start;
-    result->_refCountsPtr = (uint16_t*)byteOffset(result->_start, sizeOfTables);
+    auto zoneCount = result->_zoneCount;
+    result->_headsPtr = (uint32_t*)result->_start;
+    result->_refCountsPtr = result->_headsPtr + zoneCount;
+    result->_nextFreePtr = (int32_t*)(result->_refCountsPtr + zoneCount);
+    result->_prevFreePtr = result->_nextFreePtr + zoneCount;
 
     // shrink space for headers
-    result->_start = byteOffset(result->_start, sizeOfTables * 2);
+    result->_start = byteOffset(result->_start, sizeOfTables);
+    result->_limit = byteOffset(result->_start, ((size_t)zoneCount * zoneSize) - 1);
 
     // zero-out the tables
     auto zeroPtr = result->_headsPtr;
-    while (zeroPtr < result->_start) {
-        writeUshort(zeroPtr, 0, 0);
+    while (zeroPtr < (uint32_t*)result->_nextFreePtr) {
+        writeUint(zeroPtr, 0, 0);
         zeroPtr += 1;
     }
 
+    // every zone starts empty. Linked last to first, so the lowest zones are used first
+    for (int i = 0; i < FREE_CLASS_COUNT; i++) result->_freeLists[i] = NO_ZONE;
+    result->_freeClasses = 0;
+    for (int i = zoneCount - 1; i >= 0; i--) LinkFreeZone(result, i, FREE_CLASS_EMPTY);
+
     return result;
 }
 
@@ -138,23 +211,29 @@ void* CopyToArena(void* srcData, size_t length, Arena* target) {
 }
 
 
-uint16_t GetHead(Arena* a, int zoneIndex) {
-    return readUshort(a->_headsPtr, zoneIndex * sizeof(uint16_t));
+uint32_t GetHead(Arena* a, int zoneIndex) {
+    return readUint(a->_headsPtr, zoneIndex * sizeof(uint32_t));
+}
+uint32_t GetRefCount(Arena* a, int zoneIndex) {
+    return readUint(a->_refCountsPtr, zoneIndex * sizeof(uint32_t));
 }
-uint16_t GetRefCount(Arena* a, int zoneIndex) {
-    return readUshort(a->_refCountsPtr, zoneIndex * sizeof(uint16_t));
+void SetHead(Arena* a, int zoneIndex, uint32_t val) {
+    writeUint(a->_headsPtr, zoneIndex * sizeof(uint32_t), val);
 }
-void SetHead(Arena* a, int zoneIndex, uint16_t val) {
-    writeUshort(a->_headsPtr, zoneIndex * sizeof(uint16_t), val);
+void SetRefCount(Arena* a, int zoneIndex, uint32_t val) {
+    writeUint(a->_refCountsPtr, zoneIndex * sizeof(uint32_t), val);
 }
-void SetRefCount(Arena* a, int zoneIndex, uint16_t val) {
-    writeUshort(a->_refCountsPtr, zoneIndex * sizeof(uint16_t), val);
+
+// Largest single allocation this arena can make
+size_t ArenaZoneSize(Arena* a) {
+    if (a == nullptr) return 0;
+    return a->_zoneSize;
 }
 
 // Allocate memory of the given size
 void* ArenaAllocate(Arena* a, size_t byteCount) {
-    if (byteCount > ARENA_ZONE_SIZE) return nullptr; // Invalid allocation -- beyond max size.
     if (a == nullptr) return nullptr;
+    if (byteCount > a->_zoneSize) return nullptr; // Invalid allocation -- beyond max size.
 
 #ifdef ARENA_DEBUG
     if (a->_marked) {
@@ -162,29 +241,41 @@ void* ArenaAllocate(Arena* a, size_t byteCount) {
     }
 #endif
 
-    auto maxOff = ARENA_ZONE_SIZE - byteCount;
-    auto zoneCount = a->_zoneCount;
-
-    // scan for first arena where there is enough room
-    // we can either start from scratch each time, start from last success, or last emptied
-    for (int seq = 0; seq < zoneCount; seq++) {
-        auto i = (seq + a->_currentZone) % zoneCount; // simple scan from last active, looping back if needed
-
-        if (GetHead(a, i) > maxOff) continue; // no room in this slot
-
-        // found a slot where it will fit
-        a->_currentZone = i;
-        size_t result = GetHead(a, i); // new pointer
-        SetHead(a, i, (uint16_t) (result + byteCount)); // advance pointer to end of allocated data
+    auto maxOff = a->_zoneSize - byteCount;
+    if (a->_zoneCount < 1) return nullptr;
+
+    // Keep filling the last zone used while there's room. Otherwise take a zone from the smallest free list
+    // where every zone has room, or the first zone of the list below if that one happens to fit.
+    // Either way this is a few steps, however many zones there are and however full they are
+    int i = a->_currentZone;
+    if (GetHead(a, i) > maxOff) {
+        int needed = (byteCount > 1) ? highestBit((uint32_t)(byteCount - 1)) + 1 : 0; // smallest c where 2^c >= byteCount
+        int below = needed - 1;
+        if (below >= 0 && below < FREE_CLASS_EMPTY && a->_freeLists[below] != NO_ZONE && GetHead(a, a->_freeLists[below]) <= maxOff) {
+            i = a->_freeLists[below];
+        } else {
+            uint32_t classes = a->_freeClasses & ~((1u << needed) - 1);
+            if (classes == 0) return nullptr; // found nothing -- out of memory!
+            i = a->_freeLists[lowestBit(classes)];
+        }
+    }
 
-        auto oldRefs = GetRefCount(a, i);
-        SetRefCount(a, i, oldRefs + 1); // increase arena ref count
+    // found a slot where it will fit
+    a->_currentZone = i;
+    size_t result = GetHead(a, i); // new pointer
+    auto newHead = (uint32_t) (result + byteCount);
+    SetHead(a, i, newHead); // advance pointer to end of allocated data
 
-        return byteOffset(a->_start, result + (i * ARENA_ZONE_SIZE)); // turn the offset into an absolute position
+    int oldClass = FreeClass(a, (uint32_t)result), newClass = FreeClass(a, newHead);
+    if (newClass != oldClass) { // less room now, so maybe a different list
+        UnlinkFreeZone(a, i, oldClass);
+        LinkFreeZone(a, i, newClass);
     }
 
-    // found nothing -- out of memory!
-    return nullptr;
+    auto oldRefs = GetRefCount(a, i);
+    SetRefCount(a, i, oldRefs + 1); // increase arena ref count
+
+    return byteOffset(a->_start, result + ((size_t)i << a->_zoneShift)); // turn the offset into an absolute position
 }
 
 void* ArenaAllocateAndClear(Arena* a, size_t byteCount) {
@@ -201,7 +292,7 @@ int ZoneForPtr(Arena* a, void* ptr) {
     if (ptr < a->_start || ptr > a->_limit) return -1;
 
     ptrdiff_t rawOffset = (ptrdiff_t)ptr - (ptrdiff_t)a->_start;
-    ptrdiff_t zone = rawOffset / ARENA_ZONE_SIZE;
+    ptrdiff_t zone = rawOffset >> a->_zoneShift;
     if (zone < 0 || zone >= a->_zoneCount) return -1;
     return (int)zone;
 }
@@ -235,6 +326,11 @@ bool ArenaDereference(Arena* a, void* ptr) {
 
     // If no more references, free the block
     if (refCount == 0) {
+        int oldClass = FreeClass(a, GetHead(a, zone));
+        if (oldClass != FREE_CLASS_EMPTY) {
+            UnlinkFreeZone(a, zone, oldClass);
+            LinkFreeZone(a, zone, FREE_CLASS_EMPTY);
+        }
         SetHead(a, zone, 0);
         if (zone < a->_currentZone) a->_currentZone = zone; // keep allocations packed in low memory. Is this worth it?
     }
@@ -284,7 +380,7 @@ void ArenaGetState(Arena* a, size_t* allocatedBytes, size_t* unallocatedBytes,
         if (zoneHead > 0) occupied++;
         else empty++;
 
-        unsigned free = ARENA_ZONE_SIZE - zoneHead;
+        unsigned free = a->_zoneSize - zoneHead;
         allocated += zoneHead;
         unallocated += free;
         if (free > largestFree) largestFree = free;
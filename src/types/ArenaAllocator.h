@@ -9,8 +9,11 @@
 #include <cstdint>
 #include <cstddef>
 
-// Maximum size of a single allocation
-#define ARENA_ZONE_SIZE 65535
+// Zone size of arenas made with `NewArena`, and so the largest single allocation in them
+#define ARENA_ZONE_SIZE 65536
+
+// Largest zone size for `NewArenaWithZoneSize`
+#define ARENA_MAX_ZONE_SIZE (1 << 30)
 
 #define KILOBYTES * 1024UL
 #define MEGABYTES * 1048576
@@ -30,6 +33,11 @@ typedef Arena* ArenaPtr;
 // arena. Fragmentation may make the usable size smaller. Size should be a multiple of ARENA_ZONE_SIZE
 Arena* NewArena(size_t size);
 
+// Create a new arena with zones of `zoneSize` bytes (rounded up to a power of two, at most ARENA_MAX_ZONE_SIZE),
+// so single allocations can be up to that size. A zone is only reused once everything in it is dereferenced,
+// so big zones can hold on to more memory. Returns NULL if `zoneSize` is too big
+Arena* NewArenaWithZoneSize(size_t size, size_t zoneSize);
+
 // Call to drop an arena, deallocating all memory it contains
 void DropArena(Arena** a);
 
@@ -42,6 +50,9 @@ void* CopyToArena(void* srcData, size_t length, Arena* target);
 // Returns true if the given pointer is managed by this arena
 bool ArenaContainsPointer(Arena* a, void* ptr);
 
+// Largest single allocation this arena can make
+size_t ArenaZoneSize(Arena* a);
+
 // Allocate memory of the given size
 void* ArenaAllocate(Arena* a, size_t byteCount);
 
@@ -0,0 +1,90 @@
+#include "FrameArena.h"
+
+#include <cstdlib>
+#include <cstdint>
+
+typedef struct FrameArena {
+    // Start of the reserved memory, aligned to `FRAME_ARENA_ALIGN`
+    char* _base;
+
+    // Memory as it came from the system, to free
+    void* _reservation;
+
+    // Bytes in the reservation from `_base`
+    size_t _capacity;
+
+    // Offset from `_base` of the next allocation
+    size_t _used;
+
+    // Most bytes in use before a reset
+    size_t _highWater;
+
+    // Allocations that didn't fit
+    int _failures;
+} FrameArena;
+
+FrameArena* NewFrameArena(size_t size) {
+    auto result = (FrameArena*)malloc(sizeof(FrameArena));
+    if (result == nullptr) return nullptr;
+
+    auto reservation = malloc(size + FRAME_ARENA_ALIGN);
+    if (reservation == nullptr) {
+        free(result);
+        return nullptr;
+    }
+
+    auto address = (uintptr_t)reservation;
+    address = (address + FRAME_ARENA_ALIGN - 1) & ~((uintptr_t)FRAME_ARENA_ALIGN - 1);
+
+    result->_base = (char*)address;
+    result->_reservation = reservation;
+    result->_capacity = size;
+    result->_used = 0;
+    result->_highWater = 0;
+    result->_failures = 0;
+    return result;
+}
+
+void DropFrameArena(FrameArena** fa) {
+    if (fa == nullptr || *fa == nullptr) return;
+    free((*fa)->_reservation);
+    free(*fa);
+    *fa = nullptr;
+}
+
+void* FrameAllocate(FrameArena* fa, size_t byteCount) {
+    if (fa == nullptr) return nullptr;
+
+    // round up so the next allocation is aligned too. Zero-size allocations still get their own address
+    size_t size = (byteCount + FRAME_ARENA_ALIGN - 1) & ~((size_t)FRAME_ARENA_ALIGN - 1);
+    if (size == 0) size = FRAME_ARENA_ALIGN;
+
+    if (size > fa->_capacity - fa->_used || size < byteCount) { // won't fit (or overflowed rounding up)
+        fa->_failures++;
+        return nullptr;
+    }
+
+    void* result = fa->_base + fa->_used;
+    fa->_used += size;
+    if (fa->_used > fa->_highWater) fa->_highWater = fa->_used;
+    return result;
+}
+
+void FrameReset(FrameArena* fa) {
+    if (fa == nullptr) return;
+    fa->_used = 0;
+}
+
+void FrameArenaGetState(FrameArena* fa, size_t* usedBytes, size_t* capacity, size_t* highWater, int* failures) {
+    if (fa == nullptr) {
+        if (usedBytes != nullptr) *usedBytes = 0;
+        if (capacity != nullptr) *capacity = 0;
+        if (highWater != nullptr) *highWater = 0;
+        if (failures != nullptr) *failures = 0;
+        return;
+    }
+    if (usedBytes != nullptr) *usedBytes = fa->_used;
+    if (capacity != nullptr) *capacity = fa->_capacity;
+    if (highWater != nullptr) *highWater = fa->_highWater;
+    if (failures != nullptr) *failures = fa->_failures;
+}
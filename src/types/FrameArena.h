@@ -0,0 +1,45 @@
+#pragma clang diagnostic push
+#pragma ide diagnostic ignored "OCUnusedGlobalDeclarationInspection"
+#pragma once
+
+#ifndef FrameArena_h
+#define FrameArena_h
+
+#include <cstddef>
+
+/*
+    A bump allocator for memory that only lives until the end of a frame.
+
+    All the memory is reserved when the frame arena is made. Allocating moves a pointer up, and
+    there is no way to free one allocation; `FrameReset` drops everything at once by moving the
+    pointer back to the start. Memory is not cleared, either on allocation or on reset.
+
+    Allocations don't have the 64K limit of the `Arena` zones, and are aligned to `FRAME_ARENA_ALIGN`.
+
+    The high-water mark is the most memory in use before any reset, so the reservation can be sized
+    from a real run. Allocations that don't fit fail with NULL, and are counted.
+*/
+
+// Alignment of every allocation
+#define FRAME_ARENA_ALIGN 16
+
+typedef struct FrameArena FrameArena;
+
+// Reserve `size` bytes for a new frame arena. Returns NULL if the memory isn't available
+FrameArena* NewFrameArena(size_t size);
+
+// Release all the memory of a frame arena, and set the pointer to NULL
+void DropFrameArena(FrameArena** fa);
+
+// Allocate memory of the given size. It lives until the next `FrameReset`. Returns NULL if it won't fit
+void* FrameAllocate(FrameArena* fa, size_t byteCount);
+
+// Drop all allocations in the frame arena ( O(1) )
+void FrameReset(FrameArena* fa);
+
+// Read statistics for this frame arena. Pass `NULL` for anything you're not interested in.
+// `highWater` is the most bytes ever in use at once; `failures` counts allocations that didn't fit
+void FrameArenaGetState(FrameArena* fa, size_t* usedBytes, size_t* capacity, size_t* highWater, int* failures);
+
+#endif
+#pragma clang diagnostic pop
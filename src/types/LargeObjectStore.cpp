@@ -0,0 +1,259 @@
+#include "LargeObjectStore.h"
+#include "MathBits.h"
+
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <atomic>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+// Size classes from 2^LARGE_MIN_SHIFT to 2^LARGE_MAX_SHIFT, four to each power of two
+#define LARGE_CLASS_COUNT (((LARGE_MAX_SHIFT - LARGE_MIN_SHIFT) * 4) + 1)
+
+// Mixed with the header address to make a block's tag
+#define LARGE_TAG_SALT ((uintptr_t)0x5A17B10C)
+
+// Start of every block. The data follows straight after
+typedef struct LargeHeader {
+    // While the block is allocated: the header's address, mixed with the store's. Zero while free
+    uint64_t tag;
+
+    // Size class index
+    uint32_t sizeClass;
+
+    // Keeps the data aligned
+    uint32_t _padding;
+} LargeHeader;
+
+static_assert(sizeof(LargeHeader) == LARGE_HEADER_SIZE, "Large object header must fill LARGE_HEADER_SIZE");
+
+// A range of pages taken from the system
+typedef struct LargeSlab {
+    void* base;
+    size_t size;
+} LargeSlab;
+
+typedef struct LargeObjectStore {
+    // Guards everything below
+    std::atomic_flag _lock;
+
+    // First free block in each size class, or NULL. The next is kept in the free block's data
+    LargeHeader* _freeLists[LARGE_CLASS_COUNT];
+
+    // Every mapping made, sorted by base address. To find a block's slab, and release when the store is dropped
+    LargeSlab* _slabs;
+    int _slabCount;
+    int _slabCapacity;
+
+    // Statistics
+    size_t _mappedBytes;
+    size_t _usedBytes;
+    int _liveBlocks;
+    int _freeBlocks;
+} LargeObjectStore;
+
+
+// Block size of a size class, header included
+static inline size_t ClassSize(int sizeClass) {
+    int shift = LARGE_MIN_SHIFT + (sizeClass >> 2);
+    return ((size_t)1 << shift) + ((size_t)(sizeClass & 3) << (shift - 2));
+}
+
+// Smallest size class that holds `blockSize` bytes, or -1 if none does
+static inline int SizeClassFor(size_t blockSize) {
+    if (blockSize <= ((size_t)1 << LARGE_MIN_SHIFT)) return 0;
+    if (blockSize > ((size_t)1 << LARGE_MAX_SHIFT)) return -1;
+
+    // blockSize is in (2^k, 2^(k+1)], split into quarters
+    int k = highestBit((uint32_t)(blockSize - 1));
+    size_t step = (size_t)1 << (k - 2);
+    auto quarters = (int)((blockSize - ((size_t)1 << k) + step - 1) / step); // 1..4
+    return ((k - LARGE_MIN_SHIFT) * 4) + quarters;
+}
+
+static inline uint64_t TagFor(LargeObjectStore* store, LargeHeader* header) {
+    return (uint64_t)(((uintptr_t)header ^ (uintptr_t)store) ^ LARGE_TAG_SALT);
+}
+
+// The free list link lives in the data of a free block
+static inline LargeHeader** NextFree(LargeHeader* header) {
+    return (LargeHeader**)((char*)header + LARGE_HEADER_SIZE);
+}
+
+static inline void LockStore(LargeObjectStore* store) {
+    while (store->_lock.test_and_set(std::memory_order_acquire)) {}
+}
+
+static inline void UnlockStore(LargeObjectStore* store) {
+    store->_lock.clear(std::memory_order_release);
+}
+
+static void* MapPages(size_t size) {
+#ifdef _WIN32
+    return VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+    void* result = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return (result == MAP_FAILED) ? nullptr : result;
+#endif
+}
+
+static void UnmapPages(void* base, size_t size) {
+#ifdef _WIN32
+    (void)size;
+    VirtualFree(base, 0, MEM_RELEASE);
+#else
+    munmap(base, size);
+#endif
+}
+
+// Index of the first slab with a base above `ptr`. Must hold the lock
+static int SlabAfter(LargeObjectStore* store, const void* ptr) {
+    int low = 0, high = store->_slabCount;
+    while (low < high) {
+        int mid = (low + high) >> 1;
+        if ((uintptr_t)store->_slabs[mid].base <= (uintptr_t)ptr) low = mid + 1;
+        else high = mid;
+    }
+    return low;
+}
+
+// True if `ptr` could be the data of a block in one of the store's slabs. Must hold the lock
+static bool OwnsData(LargeObjectStore* store, const void* ptr) {
+    int index = SlabAfter(store, ptr) - 1;
+    if (index < 0) return false;
+    auto slab = &store->_slabs[index];
+    auto offset = (uintptr_t)ptr - (uintptr_t)slab->base;
+    return offset >= LARGE_HEADER_SIZE && offset < slab->size;
+}
+
+// Remember a new mapping, keeping the slabs in order. Must hold the lock
+static bool AddSlab(LargeObjectStore* store, void* base, size_t size) {
+    if (store->_slabCount >= store->_slabCapacity) {
+        int capacity = (store->_slabCapacity < 16) ? 16 : store->_slabCapacity * 2;
+        auto slabs = (LargeSlab*)realloc(store->_slabs, capacity * sizeof(LargeSlab));
+        if (slabs == nullptr) return false;
+        store->_slabs = slabs;
+        store->_slabCapacity = capacity;
+    }
+    int index = SlabAfter(store, base);
+    memmove(&store->_slabs[index + 1], &store->_slabs[index], (store->_slabCount - index) * sizeof(LargeSlab));
+    store->_slabs[index].base = base;
+    store->_slabs[index].size = size;
+    store->_slabCount++;
+    store->_mappedBytes += size;
+    return true;
+}
+
+LargeObjectStore* NewLargeObjectStore() {
+    auto result = (LargeObjectStore*)calloc(1, sizeof(LargeObjectStore));
+    if (result == nullptr) return nullptr;
+    result->_lock.clear();
+    return result;
+}
+
+void DropLargeObjectStore(LargeObjectStore** store) {
+    if (store == nullptr || *store == nullptr) return;
+    auto s = *store;
+    for (int i = 0; i < s->_slabCount; i++) {
+        UnmapPages(s->_slabs[i].base, s->_slabs[i].size);
+    }
+    free(s->_slabs);
+    free(s);
+    *store = nullptr;
+}
+
+void* LargeAllocate(LargeObjectStore* store, size_t byteCount) {
+    if (store == nullptr) return nullptr;
+    if (byteCount > ((size_t)1 << LARGE_MAX_SHIFT) - LARGE_HEADER_SIZE) return nullptr;
+    int sizeClass = SizeClassFor(byteCount + LARGE_HEADER_SIZE);
+    if (sizeClass < 0) return nullptr;
+    size_t blockSize = ClassSize(sizeClass);
+
+    LockStore(store);
+    LargeHeader* block = store->_freeLists[sizeClass];
+    if (block != nullptr) {
+        store->_freeLists[sizeClass] = *NextFree(block);
+        store->_freeBlocks--;
+        store->_usedBytes += blockSize;
+        store->_liveBlocks++;
+    }
+    UnlockStore(store);
+
+    if (block == nullptr) { // nothing to reuse. Map a new slab, outside the lock
+        size_t slabSize = (blockSize < LARGE_SLAB_SIZE) ? LARGE_SLAB_SIZE : blockSize;
+        auto base = (char*)MapPages(slabSize);
+        if (base == nullptr) return nullptr;
+
+        LockStore(store);
+        if (!AddSlab(store, base, slabSize)) {
+            UnlockStore(store);
+            UnmapPages(base, slabSize);
+            return nullptr;
+        }
+        // keep the first block, and put the rest of the slab on the free list
+        block = (LargeHeader*)base;
+        for (size_t offset = blockSize; offset + blockSize <= slabSize; offset += blockSize) {
+            auto spare = (LargeHeader*)(base + offset);
+            spare->tag = 0;
+            spare->sizeClass = (uint32_t)sizeClass;
+            *NextFree(spare) = store->_freeLists[sizeClass];
+            store->_freeLists[sizeClass] = spare;
+            store->_freeBlocks++;
+        }
+        store->_usedBytes += blockSize;
+        store->_liveBlocks++;
+        UnlockStore(store);
+    }
+
+    block->tag = TagFor(store, block);
+    block->sizeClass = (uint32_t)sizeClass;
+    return (char*)block + LARGE_HEADER_SIZE;
+}
+
+bool LargeDrop(LargeObjectStore* store, void* ptr) {
+    if (store == nullptr || ptr == nullptr) return false;
+    auto header = (LargeHeader*)((char*)ptr - LARGE_HEADER_SIZE);
+
+    LockStore(store);
+    if (!OwnsData(store, ptr)) { // not in any of our mappings. Don't touch memory in front of it
+        UnlockStore(store);
+        return false;
+    }
+    if (header->tag != TagFor(store, header) || header->sizeClass >= LARGE_CLASS_COUNT) { // not one of ours, or already dropped
+        UnlockStore(store);
+        return false;
+    }
+    int sizeClass = (int)header->sizeClass;
+    header->tag = 0;
+    *NextFree(header) = store->_freeLists[sizeClass];
+    store->_freeLists[sizeClass] = header;
+    store->_freeBlocks++;
+    store->_liveBlocks--;
+    store->_usedBytes -= ClassSize(sizeClass);
+    UnlockStore(store);
+    return true;
+}
+
+void LargeObjectStoreGetState(LargeObjectStore* store, size_t* mappedBytes, size_t* usedBytes, int* liveBlocks, int* freeBlocks) {
+    size_t mapped = 0, used = 0;
+    int live = 0, spare = 0;
+    if (store != nullptr) {
+        LockStore(store);
+        mapped = store->_mappedBytes;
+        used = store->_usedBytes;
+        live = store->_liveBlocks;
+        spare = store->_freeBlocks;
+        UnlockStore(store);
+    }
+    if (mappedBytes != nullptr) *mappedBytes = mapped;
+    if (usedBytes != nullptr) *usedBytes = used;
+    if (liveBlocks != nullptr) *liveBlocks = live;
+    if (freeBlocks != nullptr) *freeBlocks = spare;
+}
@@ -0,0 +1,68 @@
+#pragma clang diagnostic push
+#pragma ide diagnostic ignored "OCUnusedGlobalDeclarationInspection"
+#pragma once
+
+#ifndef LargeObjectStore_h
+#define LargeObjectStore_h
+
+#include <cstddef>
+
+/*
+    Allocator for objects too big for an `Arena` zone: maps, screen buffers, tile caches.
+
+    Memory comes straight from the system in whole pages (`mmap` or `VirtualAlloc`), and is never
+    handed back until the store is dropped. Freed blocks are kept for reuse instead.
+
+    Blocks are in size classes: four to each power of two (2^k, 1.25 * 2^k, 1.5 * 2^k, 1.75 * 2^k),
+    so no more than a quarter of a block is wasted. Classes smaller than `LARGE_SLAB_SIZE` are cut
+    from slabs of that size; bigger ones get a mapping each. Every class has its own free list.
+
+    Every block starts with a header giving its class, and a tag only this store would write there.
+    Dropping first checks the pointer is inside one of the store's mappings (a binary search of them,
+    kept in address order), and only then reads the header. Pointers from anywhere else are ignored.
+
+    Allocating and dropping are thread safe, and can happen on different threads.
+
+    General layout:
+
+    Slab (LARGE_SLAB_SIZE, or one big block)
+     |
+     +-[header][data...........]
+     |
+     +-[header][data...........]
+     .
+*/
+
+// Smallest size class is 2^LARGE_MIN_SHIFT bytes. Anything smaller belongs in an `Arena`
+#define LARGE_MIN_SHIFT 16
+
+// Biggest size class is 2^LARGE_MAX_SHIFT bytes, header included
+#define LARGE_MAX_SHIFT 31
+
+// Size classes cut from slabs of this many bytes. Must be a power of two
+#define LARGE_SLAB_SIZE (1 << 20)
+
+// Bytes before each block's data. Data is aligned to this too
+#define LARGE_HEADER_SIZE 16
+
+typedef struct LargeObjectStore LargeObjectStore;
+
+// Create an empty store. Returns NULL if the memory isn't available
+LargeObjectStore* NewLargeObjectStore();
+
+// Release every block and slab back to the system, and set the pointer to NULL. No other thread may be using the store
+void DropLargeObjectStore(LargeObjectStore** store);
+
+// Allocate memory of the given size. It is not cleared. Returns NULL if it's bigger than the largest class,
+// or the system is out of memory
+void* LargeAllocate(LargeObjectStore* store, size_t byteCount);
+
+// Return a block to its free list. Returns false, doing nothing, if `ptr` isn't a live block from this store
+bool LargeDrop(LargeObjectStore* store, void* ptr);
+
+// Read statistics for this store. Pass `NULL` for anything you're not interested in.
+// `mappedBytes` is everything taken from the system; `usedBytes` is the size of the live blocks
+void LargeObjectStoreGetState(LargeObjectStore* store, size_t* mappedBytes, size_t* usedBytes, int* liveBlocks, int* freeBlocks);
+
+#endif
+#pragma clang diagnostic pop
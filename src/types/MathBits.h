@@ -6,12 +6,38 @@
 #define MathBits_h
 
 #include <cstdint>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Range of the random functions below. Not the C library's `RAND_MAX`, which can be much smaller
+#define MATH_BITS_RAND_MAX 0x7FFFFFFF
 
-#define RAND_MAX 0x7FFFFFFF
+static uint32_t internal_seed = 0xDEADBEEF;
 
-uint32_t internal_seed = 0xDEADBEEF;
+// Index of the highest set bit. `value` must not be zero
+static inline int highestBit(uint32_t value) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanReverse(&index, value);
+    return (int)index;
+#else
+    return 31 - __builtin_clz(value);
+#endif
+}
+
+// Index of the lowest set bit. `value` must not be zero
+static inline int lowestBit(uint32_t value) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, value);
+    return (int)index;
+#else
+    return __builtin_ctz(value);
+#endif
+}
 
-uint32_t triple32(uint32_t* seed) {
+static inline uint32_t triple32(uint32_t* seed) {
     auto x = (seed == nullptr) ? internal_seed : *seed;
     x ^= x >> 17;
     x *= UINT32_C(0xed5ad4bb);
@@ -25,11 +51,11 @@ uint32_t triple32(uint32_t* seed) {
     return x;
 }
 
-uint32_t random_at_most(uint32_t max) {
+static inline uint32_t random_at_most(uint32_t max) {
     unsigned long
-    // max <= RAND_MAX < ULONG_MAX, so this is okay.
+    // max <= MATH_BITS_RAND_MAX < ULONG_MAX, so this is okay.
     num_bins = (unsigned long)max + 1,
-            num_rand = (unsigned long)RAND_MAX + 1,
+            num_rand = (unsigned long)MATH_BITS_RAND_MAX + 1,
             bin_size = num_rand / num_bins,
             defect = num_rand % num_bins;
     uint32_t x;
@@ -40,11 +66,11 @@ uint32_t random_at_most(uint32_t max) {
     return x / bin_size;
 }
 
-uint32_t random_at_most(uint32_t seedStep, uint32_t max) {
+static inline uint32_t random_at_most(uint32_t seedStep, uint32_t max) {
     unsigned long
-        // max <= RAND_MAX < ULONG_MAX, so this is okay.
+        // max <= MATH_BITS_RAND_MAX < ULONG_MAX, so this is okay.
         num_bins = (unsigned long)max + 1,
-        num_rand = (unsigned long)RAND_MAX + 1,
+        num_rand = (unsigned long)MATH_BITS_RAND_MAX + 1,
         bin_size = num_rand / num_bins,
         defect = num_rand % num_bins;
 
@@ -56,19 +82,19 @@ uint32_t random_at_most(uint32_t seedStep, uint32_t max) {
     return x / bin_size;
 }
 
-int32_t ranged_random(uint32_t seedStep, int32_t min, int32_t max) {
+static inline int32_t ranged_random(uint32_t seedStep, int32_t min, int32_t max) {
     uint32_t range = max - min;
     uint32_t v = random_at_most(seedStep, range);
     return ((int32_t)v) + min;
 }
 
-uint32_t int_random(uint32_t seedStep) {
+static inline uint32_t int_random(uint32_t seedStep) {
     return triple32(&seedStep);
 }
 
-float float_random(uint32_t seedStep) {
+static inline float float_random(uint32_t seedStep) {
     auto b = (float)triple32(&seedStep);
-    return b / ((float)RAND_MAX);
+    return b / ((float)MATH_BITS_RAND_MAX);
 }
 
 #endif
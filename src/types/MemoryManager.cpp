@@ -1,7 +1,10 @@
 #include "MemoryManager.h"
 #include "Vector.h"
+#include "FrameArena.h"
+#include "LargeObjectStore.h"
 
 #include <cstdlib>
+#include <atomic>
 
 #pragma clang diagnostic push
 #pragma ide diagnostic ignored "OCUnusedGlobalDeclarationInspection"
@@ -9,121 +12,133 @@
 #include <iostream>
 #endif
 
-static Vector* MEMORY_STACK = nullptr;
-static Vector* LARGE_OBJECT_LIST = nullptr;
-static volatile int LOCK = 0;
+// Each thread has its own stack of arenas, made the first time it's needed, and dropped when the thread ends
+static thread_local Vector* MEMORY_STACK = nullptr;
+
+// Each thread's per-frame scratch memory, reserved the first time it's needed, and dropped when the thread ends
+static thread_local FrameArena* FRAME_ARENA = nullptr;
+
+// Large objects are shared between threads. The store does its own locking
+static LargeObjectStore* LARGE_OBJECTS = nullptr;
+
+// Set between `StartManagedMemory` and `ShutdownManagedMemory`. Threads only make arena stacks while it's set
+static std::atomic<bool> STARTED(false);
+
+// Drops of pointers the manager couldn't find (such as another thread's arena memory), which are leaked
+static std::atomic<int> DROP_FAILURES(0);
 
 typedef Arena* ArenaPtr;
-typedef void* VoidPtr;
 
 RegisterVectorStatics(Vec)
 RegisterVectorFor(ArenaPtr, Vec)
-RegisterVectorFor(VoidPtr, Vec)
 
-// Ensure the memory manager is ready. It starts with an empty stack
-void StartManagedMemory() {
-    if (LOCK != 0) return; // weak protection, yes.
-    if (MEMORY_STACK != nullptr) return;
-    LOCK = 1;
+// Drop every arena in this thread's stack, base arena last (it holds the stack itself)
+void DropThreadStack() {
+    if (MEMORY_STACK == nullptr) return;
+    auto *vec = (Vector *) MEMORY_STACK;
+    MEMORY_STACK = nullptr;
+    ArenaPtr a = nullptr;
+    ArenaPtr baseArena = nullptr;
 
-    auto baseArena = NewArena((128 KILOBYTES));
-    MEMORY_STACK = VecAllocateArena_ArenaPtr(baseArena);
-    LARGE_OBJECT_LIST = VecAllocateArena_VoidPtr(baseArena);
-    VecPush_ArenaPtr(MEMORY_STACK, baseArena);
+    // cut the base arena out of the vector
+    VecDequeue_ArenaPtr(vec, &baseArena);
 
-    LOCK = 0;
-}
-// Close all arenas and return to stdlib memory
-void ShutdownManagedMemory() {
-    if (LOCK != 0) return;
-    LOCK = 1;
-
-    if (LARGE_OBJECT_LIST != nullptr){
-        auto *vec = (Vector *) LARGE_OBJECT_LIST;
-        LARGE_OBJECT_LIST = nullptr;
-        void* a = nullptr;
-        while (VecPop_VoidPtr(vec, &a)) {
-            free(a);
-        }
-        VecDeallocate(vec);
+    // drop all other arenas
+    while (VecPop_ArenaPtr(vec, &a)) {
+        DropArena(&a);
     }
 
-    if (MEMORY_STACK != nullptr) {
-        auto *vec = (Vector *) MEMORY_STACK;
-        MEMORY_STACK = nullptr;
-        ArenaPtr a = nullptr;
-        ArenaPtr baseArena = nullptr;
+    // drop the base arena (takes the stack with it)
+    DropArena(&baseArena);
+}
 
-        // cut the base arena out of the vector
-        VecDequeue_ArenaPtr(vec, &baseArena);
+// Drops the arenas of a thread when it ends
+typedef struct ThreadStackOwner {
+    ~ThreadStackOwner() {
+        DropThreadStack();
+        DropFrameArena(&FRAME_ARENA);
+    }
+} ThreadStackOwner;
+static thread_local ThreadStackOwner THREAD_STACK_OWNER;
 
-        // drop all other arenas
-        while (VecPop_ArenaPtr(vec, &a)) {
-            DropArena(&a);
-        }
+// This thread's arena stack, made if it doesn't have one yet. Null if the manager isn't started
+Vector* ThreadStack() {
+    if (MEMORY_STACK != nullptr) return MEMORY_STACK;
+    if (!STARTED.load()) return nullptr;
 
-        // drop the base arena (takes MEMORY_STACK and LARGE_OBJECT_LIST with it)
+    auto baseArena = NewArena((128 KILOBYTES));
+    if (baseArena == nullptr) return nullptr;
+    auto vec = VecAllocateArena_ArenaPtr(baseArena);
+    if (vec == nullptr || !VecPush_ArenaPtr(vec, baseArena)) {
         DropArena(&baseArena);
+        return nullptr;
+    }
+    (void)&THREAD_STACK_OWNER; // make sure this thread's owner exists, so the stack is dropped when it ends
+    MEMORY_STACK = vec;
+    return vec;
+}
+
+// Ensure the memory manager is ready. It starts with an empty stack
+void StartManagedMemory() {
+    if (!STARTED.load()) {
+        LARGE_OBJECTS = NewLargeObjectStore();
+        DROP_FAILURES.store(0);
+        STARTED.store(true);
     }
 
-    LOCK = 0;
+    ThreadStack();
+}
+// Close all arenas and return to stdlib memory
+void ShutdownManagedMemory() {
+    STARTED.store(false);
+    DropLargeObjectStore(&LARGE_OBJECTS);
+
+    DropThreadStack();
+    DropFrameArena(&FRAME_ARENA);
 }
 
 // Start a new arena, keeping memory and state of any existing ones
 bool MMPush(size_t arenaMemory) {
-    if (MEMORY_STACK == nullptr) return false;
-#pragma clang diagnostic push
-#pragma ide diagnostic ignored "LoopDoesntUseConditionVariableInspection"
-    while (LOCK != 0) {}
-#pragma clang diagnostic pop
-    LOCK = 1;
+    return MMPushWithZoneSize(arenaMemory, ARENA_ZONE_SIZE);
+}
 
-    auto* vec = (Vector*)MEMORY_STACK;
-    auto a = NewArena(arenaMemory);
+// Start a new arena with a given zone size, keeping memory and state of any existing ones
+bool MMPushWithZoneSize(size_t arenaMemory, size_t zoneSize) {
+    auto* vec = ThreadStack();
+    if (vec == nullptr) return false;
+
+    auto a = NewArenaWithZoneSize(arenaMemory, zoneSize);
     bool result = false;
     if (a != nullptr) {
         result = VecPush_ArenaPtr(vec, a);
         if (!result) DropArena(&a);
     }
-
-    LOCK = 0;
     return result;
 }
 
 // Deallocate the most recent arena, restoring the previous
 void MMPop() {
-    if (MEMORY_STACK == nullptr) return;
-    if (VecLength(MEMORY_STACK) <= 1) return; // don't pop off our own arena
-#pragma clang diagnostic push
-#pragma ide diagnostic ignored "LoopDoesntUseConditionVariableInspection"
-    while (LOCK != 0) {}
-#pragma clang diagnostic pop
-    LOCK = 1;
+    auto* vec = MEMORY_STACK;
+    if (vec == nullptr) return;
+    if (VecLength(vec) <= 1) return; // don't pop off our own arena
 
-    auto* vec = (Vector*)MEMORY_STACK;
     ArenaPtr a = nullptr;
     if (VecPop_ArenaPtr(vec, &a)) {
         DropArena(&a);
     }
-
-    LOCK = 0;
 }
 
 // Deallocate the most recent arena, copying a data item to the next one down (or permanent memory if at the bottom of the stack)
 void* MMPopReturn(void* ptr, size_t size) {
-    if (MEMORY_STACK == nullptr) return nullptr;
-#pragma clang diagnostic push
-#pragma ide diagnostic ignored "LoopDoesntUseConditionVariableInspection"
-    while (LOCK != 0) {}
-#pragma clang diagnostic pop
-    LOCK = 1;
+    auto* vec = MEMORY_STACK;
+    if (vec == nullptr) return nullptr;
 
     void* result;
-    auto* vec = (Vector*)MEMORY_STACK;
     ArenaPtr a = nullptr;
     if (VecPop_ArenaPtr(vec, &a)) {
-        if (VecPeek_ArenaPtr(vec, &a)) { // there is another arena. Copy there
-            result = CopyToArena(ptr, size, a);
+        ArenaPtr next = nullptr;
+        if (VecPeek_ArenaPtr(vec, &next)) { // there is another arena. Copy there
+            result = CopyToArena(ptr, size, next);
         } else { // no more arenas. Dump in regular memory
             result = MakePermanent(ptr, size);
         }
@@ -131,64 +146,86 @@ void* MMPopReturn(void* ptr, size_t size) {
     } else { // nothing to pop. Raise null to signal stack underflow
         result = nullptr;
     }
-
-    LOCK = 0;
     return result;
 }
 
 // Return the current arena, or nullptr if none pushed
-// TODO: if nothing pushed, push a new small arena
 Arena* MMCurrent() {
-    if (MEMORY_STACK == nullptr) return nullptr;
-#pragma clang diagnostic push
-#pragma ide diagnostic ignored "LoopDoesntUseConditionVariableInspection"
-    while (LOCK != 0) {}
-#pragma clang diagnostic pop
-    LOCK = 1;
+    auto* vec = ThreadStack();
+    if (vec == nullptr) return nullptr;
 
-    auto* vec = (Vector*)MEMORY_STACK;
     ArenaPtr result = nullptr;
     VecPeek_ArenaPtr(vec, &result);
-
-    LOCK = 0;
     return result;
 }
 
 void *MMAllocate(size_t byteCount) {
-    if (byteCount > ARENA_ZONE_SIZE) { // stdlib allocation and add to large object list
-        auto ptr = malloc(byteCount);
-        if (ptr != nullptr) VecPush_VoidPtr(LARGE_OBJECT_LIST, ptr);
-        return ptr;
+    auto current = MMCurrent();
+    if (current == nullptr) return nullptr;
+    if (byteCount > ArenaZoneSize(current)) { // too big for a zone. Shared large object store
+        return LargeAllocate(LARGE_OBJECTS, byteCount);
     } else { // use the small bump allocator
-        auto current = MMCurrent();
-        if (current == nullptr) return nullptr;
         return ArenaAllocate(current, byteCount);
     }
 }
 
+void* MMAllocateLarge(size_t byteCount) {
+    if (!STARTED.load()) return nullptr;
+    return LargeAllocate(LARGE_OBJECTS, byteCount);
+}
+
 // Check if the current area has this pointer, then scan down the stack.
-// Finally, try the large object list (which should not see alloc/dealloc in common code)
+// Finally, try the large object store
 void MMDrop(void *ptr) {
     auto current = MMCurrent();
     if (current != nullptr){
-        auto offset = ArenaPtrToOffset(current, ptr);
-        if (offset > 0) { // found it
+        if (ArenaContainsPointer(current, ptr)) { // in the most recent arena
             ArenaDereference(current, ptr);
             return;
         }
-        // TODO: hunt further down the stacks, return if found
-    }
 
-    // scan through the large object list, `free` if found
-    uint32_t len = VectorLength(LARGE_OBJECT_LIST);
-    for (uint32_t i = 0; i < len; ++i) {
-        auto lob = VecGet_VoidPtr(LARGE_OBJECT_LIST, i);
-        if (lob == ptr){
-            VecSet_VoidPtr(LARGE_OBJECT_LIST, i, nullptr, nullptr); // null this item so we don't double free. We could trim the array, but it shouldn't be needed.
-            free(lob);
-            return;
+        // scan down the rest of this thread's arenas
+        auto* vec = (Vector*)MEMORY_STACK;
+        int count = VecLength(vec);
+        for (int i = count - 2; i >= 0; i--) {
+            ArenaPtr af = *VecGet_ArenaPtr(vec, i);
+            if (af == nullptr) continue;
+            if (ArenaContainsPointer(af, ptr)) {
+                ArenaDereference(af, ptr);
+                return;
+            }
         }
     }
+
+    // the store checks it owns the block before reading its header
+    if (LargeDrop(LARGE_OBJECTS, ptr) || ptr == nullptr) return;
+
+    // never found it. Most likely arena memory of another thread, which is leaked until that arena is popped
+    DROP_FAILURES++;
+}
+
+int MMDropFailures() {
+    return DROP_FAILURES.load();
+}
+
+// Allocate from this thread's frame arena, reserving it on first use
+void* MMFrameAllocate(size_t byteCount) {
+    if (FRAME_ARENA == nullptr) {
+        if (!STARTED.load()) return nullptr;
+        FRAME_ARENA = NewFrameArena(FRAME_ARENA_SIZE);
+        if (FRAME_ARENA == nullptr) return nullptr;
+        (void)&THREAD_STACK_OWNER; // drop it when the thread ends
+    }
+    return FrameAllocate(FRAME_ARENA, byteCount);
+}
+
+// Drop this thread's frame allocations. The memory stays reserved
+void MMFrameReset() {
+    FrameReset(FRAME_ARENA);
+}
+
+void MMFrameState(size_t* highWater, size_t* capacity, int* failures) {
+    FrameArenaGetState(FRAME_ARENA, nullptr, capacity, highWater, failures);
 }
 
 // Allocate memory array, cleared to zeros
@@ -215,15 +252,8 @@ void mfree(void* ptr) {
         return;
     }
 
-    // otherwise, scan through all the arenas until we find it
+    // otherwise, scan through all of this thread's arenas until we find it
     // it might be simpler to leak the memory and let the arena get cleaned up whenever
-
-#pragma clang diagnostic push
-#pragma ide diagnostic ignored "LoopDoesntUseConditionVariableInspection"
-    while (LOCK != 0) {}
-#pragma clang diagnostic pop
-    LOCK = 1;
-
     auto* vec = (Vector*)MEMORY_STACK;
     int count = VecLength(vec);
     for (int i = 0; i < count; i++) {
@@ -234,12 +264,12 @@ void mfree(void* ptr) {
             return;
         }
     }
-    // never found it. Either bad call or we've leaked some memory
+    if (LargeDrop(LARGE_OBJECTS, ptr)) return;
 
+    // never found it. Either bad call or we've leaked some memory
+    DROP_FAILURES++;
 #ifdef ARENA_DEBUG
     std::cout << "mfree failed. Memory leaked.\n";
 #endif
-
-    LOCK = 0;
 }
 #pragma clang diagnostic pop
\ No newline at end of file
@@ -14,6 +14,16 @@
     Uses the most recently pushed Arena.
     Uses the stdlib versions if no arenas have been pushed, or if not set up.
     When an arena is popped from the manager, it is deallocated
+
+    Every thread has its own stack of arenas, so pushing, popping and allocating need no locks. A thread's stack
+    is made the first time it's used (after `StartManagedMemory`), and dropped with all its arenas when the thread
+    ends. Memory from a thread's arenas can be read by any thread, but only dropped by the one that allocated it.
+    Large objects are shared by all threads, and can be dropped from any of them. They live in a `LargeObjectStore`,
+    where dropped blocks are kept for reuse rather than given back to the system.
+
+    Each thread also has a frame arena for scratch memory that only lives for one frame (sort buffers, sprite
+    lists and the like). It's reserved once, the first time the thread asks for it, and each thread resets its own
+    at its frame boundary.
 */
 
 /*
@@ -29,8 +39,8 @@
     Return values can either be copied out of the closing arena into a different one,
     or be written as produced to another arena.
 
-    At the moment, the maximum allocated chunk size inside an arena is 64K. Use one of the
-    container classes to exceed this.
+    The maximum allocated chunk size inside an arena is its zone size: 64K unless the arena was made
+    with a bigger one. Bigger allocations go to the large object store, or use one of the container classes.
 
     General layout:
 
@@ -51,24 +61,39 @@
 
 // Ensure the memory manager is ready. It starts with an empty stack
 void StartManagedMemory();
-// Close all arenas and return to stdlib memory
+// Close the calling thread's arenas and all large objects, and return to stdlib memory.
+// Other threads that used the manager should have ended first
 void ShutdownManagedMemory();
 
 
 //------[ ALLOCATING MEMORY ]------//
 
 // Allocate memory for a given size
-// This will either allocate in the current Arena, or in the large object store (if over 64K)
+// This will either allocate in the current Arena, or in the large object store (if bigger than its zones)
 void* MMAllocate(size_t byteCount);
 
-// Dereference or deallocate a pointer. This may be slow if referencing a pointer not in the current Arena.
+// Allocate memory for a given size in the large object store, whatever the current Arena's zone size.
+// For long-lived buffers that shouldn't fill up an Arena. Drop with `MMDrop`
+void* MMAllocateLarge(size_t byteCount);
+
+// Dereference or deallocate a pointer. The calling thread's arenas are searched from the current one down, then the
+// large object store. Pointers from anywhere else are ignored.
+// Arena memory is only dropped by the thread that allocated it
 void MMDrop(void* ptr);
 
+// How many `MMDrop` and `mfree` calls, on any thread, didn't find their pointer since the manager started.
+// Each one is memory leaked until its arena is dropped
+int MMDropFailures();
+
 //------[ ARENA MANAGEMENT ]------//
 
 // Start a new arena, keeping memory and state of any existing ones
 bool MMPush(size_t arenaMemory);
 
+// Start a new arena with zones of `zoneSize` bytes, so allocations up to that size stay in the arena.
+// See `NewArenaWithZoneSize`
+bool MMPushWithZoneSize(size_t arenaMemory, size_t zoneSize);
+
 // Deallocate the most recent arena, restoring the previous
 void MMPop();
 
@@ -76,8 +101,24 @@ void MMPop();
 // NOTE: THIS IS A SHALLOW COPY!
 void* MMPopReturn(void* ptr, size_t size);
 
-// Return the current arena, or NULL if none pushed
+// Return the calling thread's current arena, or NULL if the manager isn't started
 Arena* MMCurrent();
 
+//------[ PER-FRAME SCRATCH ]------//
+
+// Bytes reserved for each thread's frame arena
+#define FRAME_ARENA_SIZE (1 MEGABYTE)
+
+// Allocate from the calling thread's frame arena. The memory is not cleared, and lives until the thread calls
+// `MMFrameReset`. Returns NULL if the manager isn't started, or the frame arena is full
+void* MMFrameAllocate(size_t byteCount);
+
+// Drop everything the calling thread allocated with `MMFrameAllocate` ( O(1) ). Call once per frame
+void MMFrameReset();
+
+// Read the calling thread's frame arena statistics: the most bytes in use in one frame, bytes reserved, and how many
+// allocations didn't fit. Pass `NULL` for anything you're not interested in. All zero if it has no frame arena
+void MMFrameState(size_t* highWater, size_t* capacity, int* failures);
+
 #endif
 #pragma clang diagnostic pop
\ No newline at end of file
@@ -19,7 +19,7 @@ typedef struct Vector {
     // Number of bytes in each element
     uint32_t ElementByteSize;
     // Size of an allocated chunk (should be `ElemsPerChunk` * `ElementByteSize`)
-    uint16_t ChunkBytes;
+    uint32_t ChunkBytes;
 
     // dynamic parts
 
@@ -57,9 +57,9 @@ const int INDEX_SIZE = sizeof(unsigned int); // size of index data
 const int SKIP_ELEM_SIZE = INDEX_SIZE + PTR_SIZE; // size of skip list entries
 
 // Tuning parameters: have a play if you have performance or memory issues.
-const int ARENA_SIZE = 65535; // number of bytes for each chunk (limit -- should match any restriction in the allocator)
+// Chunks are limited to the zone size of the vector's arena (see `ArenaZoneSize`)
 
-// Desired maximum elements per chunk. This will be reduced if element is large (to fit in Arena limit)
+// Desired maximum elements per chunk. This will be reduced if element is large (to fit in Arena zone)
 // Larger values are significantly faster for big arrays, but more memory-wasteful on small arrays
 // This should ALWAYS be a power-of-2
 const int TARGET_ELEMS_PER_CHUNK = 128;
@@ -172,8 +172,7 @@ bool FindNearestChunk(Vector *v, uint32_t targetIndex, void **chunkPtr, unsigned
     {
         // guess search bounds
         auto guess = ((targetChunkIdx - 1) * v->_skipEntries) / endChunkIdx;
-        auto lower = guess - 1;
-        if (lower < 0) lower = 0;
+        auto lower = (guess > 0) ? guess - 1 : 0; // unsigned, so can't test for negative after
 
         var baseAddr = byteOffset(v->_skipTable, (SKIP_ELEM_SIZE * lower)); // pointer to skip table entry
         startChunkIdx = readUint(baseAddr, 0);
@@ -313,8 +312,8 @@ Vector *VectorAllocateArena(Arena* a, size_t elementSize) {
     result->_arena = a;
     result->ElementByteSize = elementSize;
 
-    // Work out how many elements can fit in an arena
-    auto spaceForElements = ARENA_SIZE - PTR_SIZE; // need pointer space
+    // Work out how many elements can fit in one of the arena's zones
+    auto spaceForElements = ArenaZoneSize(a) - PTR_SIZE; // need pointer space
     result->ElemsPerChunk = (int)(spaceForElements / result->ElementByteSize);
 
     if (result->ElemsPerChunk <= 1) {
@@ -326,10 +325,12 @@ Vector *VectorAllocateArena(Arena* a, size_t elementSize) {
         result->ElemsPerChunk = TARGET_ELEMS_PER_CHUNK; // no need to go crazy with small items.
 
     // Force to a power-of-two, and store the log2 of that (to use as a bit-shift parameter)
-    result->ElemsPerChunk = NextPow2(result->ElemsPerChunk - 1); // force to a power of two
+    auto pow2 = NextPow2(result->ElemsPerChunk);
+    if (pow2 > result->ElemsPerChunk) pow2 >>= 1; // round down, so the chunk still fits in a zone
+    result->ElemsPerChunk = pow2;
     result->ElemChunkLog2 = Log2(result->ElemsPerChunk);
 
-    result->ChunkBytes = (unsigned short)(PTR_SIZE + (result->ElemsPerChunk * result->ElementByteSize));
+    result->ChunkBytes = (uint32_t)(PTR_SIZE + (result->ElemsPerChunk * result->ElementByteSize));
 
     // Make a table, which can store a few chunks, and can have a next-chunk-table pointer
     // Each chunk can hold a few elements.